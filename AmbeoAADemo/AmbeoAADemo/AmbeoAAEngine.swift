@@ -60,7 +60,6 @@ public class AmbeoAAEngine {
     var ashRecorder: AVAudioRecorder?
     var ashAudioFilename: String = "recordingASH.caf"
     var leiaAUAudioFilename: String = "recordingAA.caf"
-    var leiaAUAudioFile: AVAudioFile?
 
     // MARK: Initialization
 
@@ -308,19 +307,11 @@ public class AmbeoAAEngine {
             }
 
             // Recording LeiaAU
-            // If you want to record the "Augmented Audio" from
-            // LeiaAU, you must install a tap on the mixer:
-            do {
-                try leiaAUAudioFile = AVAudioFile(forWriting: getAudioFileURL(leiaAUAudioFilename), settings: recordingSettings)
-            } catch let error {
-                print("AmbeoAAEngine - Failed to initialize \(leiaAUAudioFilename). \(error)")
-            }
-            mixerNode.installTap(onBus: 0, bufferSize: AVAudioFrameCount(LeiaAU.frameCount()), format: mixerNode.outputFormat(forBus: 0)) { (buffer, time) -> Void in
-                do {
-                    try self.leiaAUAudioFile?.write(from: buffer)
-                } catch let error {
-                    print("AmbeoAAEngine - Failed to write buffer to \(self.leiaAUAudioFilename). \(error)")
-                }
+            // LeiaAU records the "Augmented Audio" itself: its render thread only copies the output
+            // into buffers that a background thread writes to the file. Pass `true` to record the
+            // input of each of LeiaAU's input busses to separate files as well.
+            if (!leiaAU.startOutputRecording(getAudioFileURL(leiaAUAudioFilename).path, false, .CAF)) {
+                print("AmbeoAAEngine - Failed to record LeiaAU to \(leiaAUAudioFilename).")
             }
         }
 
@@ -354,10 +345,10 @@ public class AmbeoAAEngine {
         print("AmbeoAAEngine - Stopped playing.")
 
         // Stop recordings
+        leiaAU.stopOutputRecording()
         if (isRecording) {
             ashRecorder?.stop()
             isRecording = false
-            engine.mainMixerNode.removeTap(onBus: 0)
             print("AmbeoAAEngine - Stopped recording. File writing complete.")
         }
 
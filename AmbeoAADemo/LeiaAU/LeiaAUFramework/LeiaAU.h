@@ -16,11 +16,27 @@
 
 #define FourCCChars(CC) ((int)(CC)>>24)&0xff, ((int)(CC)>>16)&0xff, ((int)(CC)>>8)&0xff, (int)(CC)&0xff
 
+/** How much of the source audio a call recording contains; see startLeiaAuCallRecording. */
+typedef NS_ENUM(NSInteger, LeiaAuCallAudio) {
+    LeiaAuCallAudioNone = 0,  // the replay feeds noise to the sources
+    LeiaAuCallAudioHash,      // a hash of each block; the replay feeds silent blocks as silence, the others as noise
+    LeiaAuCallAudioSamples    // all samples and their hash, which the replay verifies; about 10 MB per source and minute
+};
+
+/** The file format of an output recording; see startLeiaAuOutputRecording. Samples are 32-bit float. */
+typedef NS_ENUM(NSInteger, LeiaAuRecordingFormat) {
+    LeiaAuRecordingFormatCAF = 0,
+    LeiaAuRecordingFormatWAV
+};
+
 @interface LeiaAU : AUAudioUnit
 
 @property (weak) LeiaAUViewController* leiaAUViewController;
 
-/** @return sample rate of LeiaAU */
+/**
+ * @return sample rate of the Leia engine inside LeiaAU. Hosts may run LeiaAU's busses
+ *         at another sample rate, at the cost of the conversion latency reported by `latency`.
+ */
 + (float) sampleRate;
 
 /** @return frame count of LeiaAU */
@@ -65,12 +81,132 @@
 - (void) addLeiaAuSource: (int) sourceId :(float) x :(float) y :(float) z;
 
 /**
- * Remove a source from LeiaAU.
+ * Add a sound source to LeiaAU that streams its audio from a file, with initial position in SceneKit coordinates.
+ * The file is decoded ahead of time on a background thread, so the source does not use an input bus.
+ * The source is silent until that thread has decoded the start of the file, usually within a few milliseconds.
+ *
+ * @param sourceId A unique integer ID for the source.
+ * @param path  The path of an audio file that ExtAudioFile can read (e.g. mp3, caf, wav).
+ * @param loop  Whether to restart the file from the beginning when it ends.
+ * @param x  The initial X position.
+ * @param y  The initial Y position.
+ * @param z  The initial Z position.
+ *
+ * @return NO if the file could not be opened, or the maximum number of streaming sources is reached.
+ */
+- (BOOL) addLeiaAuStreamingSource: (int) sourceId :(NSString *) path :(BOOL) loop :(float) x :(float) y :(float) z;
+
+/**
+ * Remove a source from LeiaAU. This removes input bus sources and streaming sources alike.
  *
  * @param source_id  An integer source identifier.
  */
 - (void) removeLeiaAuSource: (int) source_id;
 
+/**
+ * @return the number of blocks for which a streaming source's audio was not decoded in time.
+ */
+- (int) getLeiaAuStreamingSourceUnderruns: (int) source_id;
+
+/**
+ * Preallocate the buffers of streaming sources, so that adding and removing up to `count` of them
+ * while audio is running does not allocate in LeiaAU. This covers only LeiaAU's own buffers: adding
+ * or removing any source, streaming or input bus, still lets the Leia engine allocate in
+ * leia_source_add() and leia_source_remove(). Both are called on the calling thread, never on the
+ * audio thread. Input bus sources need no reservation, as LeiaAU allocates nothing for them.
+ * Call this before adding any streaming source; a later call replaces the reservation.
+ *
+ * @param count  The number of streaming sources to reserve memory for.
+ *
+ * @return NO if streaming sources are in use, or `count` exceeds the maximum number of streaming sources.
+ */
+- (BOOL) reserveLeiaAuSources: (int) count;
+
+/**
+ * Render the sources ahead of time on a worker thread, so that load spikes in the Leia engine
+ * do not cause dropouts. The audio callback then only copies the rendered output, which adds the
+ * reported `latency`. Head rotation is applied as each block is rendered, so it is heard that much later.
+ * The input of input bus sources is queued to the worker with each callback, and rendered that many
+ * blocks later, which takes at least 2 blocks. Set this before allocating the render resources.
+ *
+ * @param blocks  The number of blocks to render ahead, from 2 to 8, or 0 to render in the audio callback (default).
+ *
+ * @return NO if the render resources are allocated, or `blocks` is out of range.
+ */
+- (BOOL) setLeiaAuRenderAheadBlocks: (int) blocks;
+
+/**
+ * @return the number of audio callbacks for which the blocks rendered ahead were not ready in time, plus
+ *         the number of times input bus audio was dropped because the worker had fallen too far behind.
+ */
+- (int) getLeiaAuRenderAheadUnderruns;
+
+/**
+ * @return the number of sources added to LeiaAU, input bus and streaming sources alike.
+ */
+- (int) getLeiaAuRegisteredSourceCount;
+
+/**
+ * @return the number of sources the Leia engine processes. A streaming source whose audio has been
+ *         silent for longer than its reverberation tail is taken out of the engine until audible audio
+ *         is decoded for it again. Input bus sources are always processed, as their audio is not known ahead.
+ */
+- (int) getLeiaAuActiveSourceCount;
+
+/**
+ * Enable or disable taking silent streaming sources out of the Leia engine. It is enabled by default.
+ *
+ * @param enabled  Whether silent streaming sources are taken out of the engine.
+ */
+- (void) setLeiaAuSilentSourceSkipping: (BOOL) enabled;
+
+/**
+ * Start recording every call LeiaAU makes to the Leia engine, including its audio updates and
+ * processing, to a log file. Tools/LeiaAUReplay.cpp replays such a log against a fresh engine,
+ * to reproduce and profile a session offline. The log starts with the listener, environment
+ * and sources as they are when recording starts, so recording can start at any time.
+ *
+ * @param path  The path of the log file, which is overwritten.
+ * @param audio  How much of the source audio to record.
+ *
+ * @return NO if the file could not be created.
+ */
+- (BOOL) startLeiaAuCallRecording: (NSString *) path :(LeiaAuCallAudio) audio;
+
+/**
+ * Stop recording calls, and complete the log file.
+ */
+- (void) stopLeiaAuCallRecording;
+
+/**
+ * Start recording LeiaAU's binaural output to an audio file. The render thread only copies each
+ * block into preallocated buffers; a background thread writes them to disk, so recording never
+ * blocks the audio. Blocks are dropped if the disk cannot keep up for more than two seconds.
+ *
+ * The input of each input bus source can be recorded as well, one file per source: a source keeps
+ * its file when removing another source moves it to another bus. Its file starts when the source
+ * is added, at the output frame in its name, and ends when it is removed. The inputs are recorded
+ * as the host delivers them, also while rendering ahead, so the output lags them by `latency`.
+ *
+ * @param path  The path of the output file, which is overwritten.
+ * @param busInputs  Whether to record the input of each input bus source as well, to `path` with
+ *                   "-source<id>-<frame>" inserted before the extension.
+ * @param format  The file format.
+ *
+ * @return NO if LeiaAU is already recording its output.
+ */
+- (BOOL) startLeiaAuOutputRecording: (NSString *) path :(BOOL) busInputs :(LeiaAuRecordingFormat) format NS_SWIFT_NAME(startOutputRecording(_:_:_:));
+
+/**
+ * Stop recording LeiaAU's output, and complete the files.
+ */
+- (void) stopLeiaAuOutputRecording NS_SWIFT_NAME(stopOutputRecording());
+
+/**
+ * @return the number of frames dropped from the current or last output recording, across all files.
+ */
+- (int) getLeiaAuOutputRecordingDroppedFrames;
+
 /**
  * @return the array mapping which source ID is at which input buffer index.
  */
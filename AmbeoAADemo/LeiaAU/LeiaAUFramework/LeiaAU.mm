@@ -15,8 +15,18 @@
 
 #import "LeiaAUFramework/LeiaAUFramework-Swift.h"
 #import "SennheiserAmbeoLeia.h"
-
+#import "LeiaAUCallRecorder.h"
+#import "LeiaAUOutputRecorder.h"
+#import "LeiaAURenderAhead.h"
+#import "LeiaAUResampler.h"
+#import "LeiaAUSourceActivity.h"
+#import "LeiaAUSourcePool.h"
+#import "LeiaAUSourceStreamer.h"
+#import "LeiaAUTableFile.h"
+
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #pragma mark LeiaAU
 
@@ -24,6 +34,8 @@ static const LeiaSampleRate SAMPLE_RATE = SAMPLERATE_44100;
 static const AUAudioFrameCount FRAME_COUNT = 512;
 static const int MAX_NUM_SOURCES = 8; // set this to the maximum number of sources we expect in the host app
 static const int MAX_NUM_SOURCE_CHANNELS = 1; // currently, LeiaAU supports only independent mono sources
+static const int RESAMPLER_PRIME_FRAMES = 2; // output frames of silence absorbing the jitter of the resampled block size
+static const TableSectionFormat RESAMPLER_COEFFICIENT_FORMAT = TABLE_FORMAT_FLOAT32; // FLOAT16 halves the filter banks' cache footprint; falls back to FLOAT32 without vector kernels
 
 #pragma mark - LeiaAU : AUAudioUnit
 
@@ -34,7 +46,6 @@ static const int MAX_NUM_SOURCE_CHANNELS = 1; // currently, LeiaAU supports only
     @property AUAudioChannelCount channelCountInput;
     @property AUAudioChannelCount channelCountOutput;
     @property LeiaInstance *leiaEngine;
-    @property NSMutableArray *leiaSourceIds;
 @end
 
 #pragma mark BufferedAudioBus Utility Class
@@ -118,9 +129,138 @@ struct BufferedInputBus : BufferedAudioBus {
     }
 };
 
+#pragma mark - HostRateConverter
+
+/**
+ * HostRateConverter lets the Leia engine run at SAMPLE_RATE when the host runs
+ * LeiaAU's busses at another sample rate.
+ *
+ * Each source is converted to the engine rate on input. The binaural output is converted
+ * back once, after the engine has mixed all sources, and is buffered in a small FIFO,
+ * since the number of engine frames per host block varies by a frame or so.
+ */
+struct HostRateConverter {
+
+    bool enabled = false;
+    PolyphaseFilterBank inputBank;
+    PolyphaseFilterBank outputBank;
+    PolyphaseResampler inputResampler;
+    PolyphaseResampler outputResampler;
+    std::vector<float> engineInput;   // MAX_NUM_SOURCES channels of maxEngineFrames
+    std::vector<float> engineOutput;  // 2 channels of maxEngineFrames
+    std::vector<float> outputFifo;    // 2 channels of fifoCapacity
+    int maxEngineFrames = 0;
+    int fifoCapacity = 0;
+    int fifoFrames = 0;
+    int numActiveInputs = 0;
+    int activeSourceIds[MAX_NUM_SOURCES] = {};   // the source each input channel converted last
+    double hostSampleRate = 0.0;
+
+    void allocateRenderResources(const MappedTableFile& tables, double hostRate, AUAudioFrameCount maxHostFrames) {
+        hostSampleRate = hostRate;
+        enabled = (int) hostRate != SAMPLE_RATE;
+        if (!enabled) { return; }
+
+        // Prefer the offline baked filter banks, which are shared through the page cache.
+        const TableSectionFormat format = vectorizedCoefficientFormat(RESAMPLER_COEFFICIENT_FORMAT);
+        if (!inputBank.attach(tables, (int) hostRate, SAMPLE_RATE, format)) {
+            inputBank.design((int) hostRate, SAMPLE_RATE);
+            inputBank.compact(format);
+        }
+        if (!outputBank.attach(tables, SAMPLE_RATE, (int) hostRate, format)) {
+            outputBank.design(SAMPLE_RATE, (int) hostRate);
+            outputBank.compact(format);
+        }
+        inputResampler.init(&inputBank, MAX_NUM_SOURCES, maxHostFrames);
+        maxEngineFrames = inputResampler.maxOutputFrames(maxHostFrames);
+        outputResampler.init(&outputBank, 2, maxEngineFrames);
+        fifoCapacity = RESAMPLER_PRIME_FRAMES + (int) maxHostFrames + outputResampler.maxOutputFrames(maxEngineFrames);
+
+        engineInput.assign((size_t) MAX_NUM_SOURCES * maxEngineFrames, 0.0f);
+        engineOutput.assign((size_t) 2 * maxEngineFrames, 0.0f);
+        outputFifo.assign((size_t) 2 * fifoCapacity, 0.0f);
+        fifoFrames = RESAMPLER_PRIME_FRAMES;
+        numActiveInputs = 0;
+        printf("LeiaAU - Converting host sample rate %.0f to engine sample rate %d (%s filter banks).\n",
+               hostRate, SAMPLE_RATE, inputBank.baked ? "baked" : "computed");
+    }
+
+    void deallocateRenderResources() {
+        enabled = false;
+        engineInput.clear();
+        engineOutput.clear();
+        outputFifo.clear();
+    }
+
+    float* engineInputChannel(int i) {
+        return engineInput.data() + (size_t) i * maxEngineFrames;
+    }
+
+    float* engineOutputChannel(int c) {
+        return engineOutput.data() + (size_t) c * maxEngineFrames;
+    }
+
+    /**
+     * Converts one host block of each input to the engine rate, into engineInputChannel().
+     *
+     * @param sourceIds  The source of each input; an input whose source changed starts without history.
+     *
+     * @return the number of engine frames to process.
+     */
+    int convertInputs(const float* const* hostInputs, const int* sourceIds, int numInputs, AUAudioFrameCount hostFrames) {
+        // Removing a source moves the sources of later busses down, so compare sources, not just the count.
+        for (int i = 0; i < numInputs; ++i) {
+            if (i >= numActiveInputs || activeSourceIds[i] != sourceIds[i]) {
+                inputResampler.resetChannel(i);
+                activeSourceIds[i] = sourceIds[i];
+            }
+        }
+        numActiveInputs = numInputs;
+        float* engineInputs[MAX_NUM_SOURCES];
+        for (int i = 0; i < numInputs; ++i) {
+            engineInputs[i] = engineInputChannel(i);
+        }
+        return inputResampler.process(hostInputs, engineInputs, numInputs, (int) hostFrames);
+    }
+
+    /** Converts engineFrames of engineOutputChannel() to the host rate, and writes one host block. */
+    void convertOutput(int engineFrames, float* const* hostOutputs, AUAudioFrameCount hostFrames) {
+        const float* engineOutputs[2] = { engineOutputChannel(0), engineOutputChannel(1) };
+        float* fifoTails[2] = {
+            outputFifo.data() + fifoFrames,
+            outputFifo.data() + fifoCapacity + fifoFrames
+        };
+        fifoFrames += outputResampler.process(engineOutputs, fifoTails, 2, engineFrames);
+
+        const int available = std::min(fifoFrames, (int) hostFrames);
+        for (int c = 0; c < 2; ++c) {
+            float* fifo = outputFifo.data() + (size_t) c * fifoCapacity;
+            memcpy(hostOutputs[c], fifo, available * sizeof(float));
+            memset(hostOutputs[c] + available, 0, (hostFrames - available) * sizeof(float));
+            memmove(fifo, fifo + available, (fifoFrames - available) * sizeof(float));
+        }
+        fifoFrames -= available;
+    }
+
+    /** The delay added by both filters and the FIFO, in seconds. */
+    double latencyInSeconds() const {
+        if (!enabled) { return 0.0; }
+        return (inputBank.delayInInputSamples() + RESAMPLER_PRIME_FRAMES) / hostSampleRate
+             + outputBank.delayInInputSamples() / SAMPLE_RATE;
+    }
+};
+
 @implementation LeiaAU {
     // C++ members need to be ivars; they would be copied on access if they were properties.
     BufferedInputBus bufferedInputBusses[MAX_NUM_SOURCES];
+    MappedTableFile bakedTables;
+    HostRateConverter hostRateConverter;
+    SourceStreamer sourceStreamer;
+    CallRecorder callRecorder;
+    SourceActivityTracker sourceActivity;
+    BusSourceTable<MAX_NUM_SOURCES> busSources;
+    RenderAheadPipeline renderAhead;
+    OutputRecorder outputRecorder;
 }
 
 + (float) sampleRate {
@@ -153,6 +293,7 @@ struct BufferedInputBus : BufferedAudioBus {
     // The output bus has 2 channels (binaural stereo).
     AVAudioFormat *defaultFormatInput = [[AVAudioFormat alloc] initStandardFormatWithSampleRate:SAMPLE_RATE channels:MAX_NUM_SOURCE_CHANNELS];
     AVAudioFormat *defaultFormatOutput = [[AVAudioFormat alloc] initStandardFormatWithSampleRate:SAMPLE_RATE channels:2]; // binaural stereo
+    // Hosts may change the busses to another sample rate; see HostRateConverter.
 
     // Initialize the input busses and output bus.
     for (int bus = 0; bus < MAX_NUM_SOURCES; bus++) {
@@ -186,15 +327,35 @@ struct BufferedInputBus : BufferedAudioBus {
     self.leiaEngine = leia_new(SAMPLE_RATE, FRAME_COUNT);
     printf("LeiaAU - Leia engine instance created with sample rate %.0u, preferred frame count %d,", SAMPLE_RATE, FRAME_COUNT);
     printf(" and %lu input busses available.\n", (unsigned long)_inputBusArray.count);
-    
-    // Create array of LeiaSource IDs
-    self.leiaSourceIds = [NSMutableArray array];
+
+    // Map the offline baked tables (see Tools/LeiaAUBakeTables.cpp), if the bundle contains
+    // a table file matching our sample rate and frame count. Tables not found there are computed.
+    NSString *tablePath = [[NSBundle bundleForClass:[self class]] pathForResource:@"LeiaAUTables" ofType:@"bin"];
+    if (tablePath != nil && bakedTables.map([tablePath fileSystemRepresentation], SAMPLE_RATE, FRAME_COUNT)) {
+        printf("LeiaAU - Mapped %u baked table sections.\n", bakedTables.header()->numSections);
+    }
+
+    // Silent streaming sources are taken out of the engine until their audio is audible again.
+    sourceActivity.init(MAX_NUM_SOURCES + MAX_NUM_STREAMING_SOURCES, SAMPLE_RATE, FRAME_COUNT, &callRecorder);
+
+    // File-backed sources are decoded straight to the engine's sample rate.
+    sourceStreamer.init(self.leiaEngine, &sourceActivity, SAMPLE_RATE, FRAME_COUNT);
+
+    // The engine can optionally render ahead on a worker thread; off by default.
+    renderAhead.init(self.leiaEngine, &sourceStreamer, &sourceActivity, &callRecorder, FRAME_COUNT, SAMPLE_RATE, MAX_NUM_SOURCES);
+
+    // The output, and optionally the input busses, can be recorded to files off the render thread.
+    outputRecorder.init(MAX_NUM_SOURCES);
 
     return self;
 }
 
 -(void)dealloc {
-    // Delete the Leia engine instance
+    // Stop rendering ahead, decoding streaming sources and recording, then delete the Leia engine instance
+    renderAhead.stop();
+    sourceStreamer.stop();
+    callRecorder.stop();
+    outputRecorder.stop();
     leia_delete(self.leiaEngine);
 }
 
@@ -215,9 +376,23 @@ struct BufferedInputBus : BufferedAudioBus {
 - (BOOL)allocateRenderResourcesAndReturnError:(NSError **)outError {
     if (![super allocateRenderResourcesAndReturnError:outError]) { return NO; }
 
+    // The engine always runs at SAMPLE_RATE; all busses must share the host's sample rate.
+    const double hostSampleRate = self.outputBus.format.sampleRate;
+    for (int bus = 0; bus < MAX_NUM_SOURCES; bus++) {
+        if (bufferedInputBusses[bus].bus.format.sampleRate != hostSampleRate) {
+            if (outError) {
+                *outError = [NSError errorWithDomain:NSOSStatusErrorDomain code:kAudioUnitErr_FormatNotSupported userInfo:nil];
+            }
+            return NO;
+        }
+    }
+
     for (int bus = 0; bus < MAX_NUM_SOURCES; bus++) {
         bufferedInputBusses[bus].allocateRenderResources(self.maximumFramesToRender);
     }
+    hostRateConverter.allocateRenderResources(bakedTables, hostSampleRate, self.maximumFramesToRender);
+    sourceStreamer.setRenderingEnabled(true);
+    renderAhead.start(hostRateConverter.enabled ? hostRateConverter.maxEngineFrames : (int) self.maximumFramesToRender);
     return YES;
 }
 
@@ -229,6 +404,9 @@ struct BufferedInputBus : BufferedAudioBus {
     for (int bus = 0; bus < MAX_NUM_SOURCES; bus++) {
         bufferedInputBusses[bus].deallocateRenderResources();
     }
+    renderAhead.stop();
+    hostRateConverter.deallocateRenderResources();
+    sourceStreamer.setRenderingEnabled(false);
     [super deallocateRenderResources];
 }
 
@@ -239,6 +417,14 @@ struct BufferedInputBus : BufferedAudioBus {
     return NO;
 }
 
+/**
+ * The delay of the sample rate conversion, if the host does not run at the engine's sample rate,
+ * plus the blocks rendered ahead, if enabled.
+ */
+- (NSTimeInterval)latency {
+    return hostRateConverter.latencyInSeconds() + renderAhead.latencyInSeconds();
+}
+
 #pragma mark - AUAudioUnit (AUAudioUnitImplementation)
 
 /**
@@ -246,6 +432,13 @@ struct BufferedInputBus : BufferedAudioBus {
  */
 - (AUInternalRenderBlock)internalRenderBlock {
     __block BufferedInputBus *inputBusses = bufferedInputBusses;
+    __block HostRateConverter *converter = &hostRateConverter;
+    __block SourceStreamer *streamer = &sourceStreamer;
+    __block CallRecorder *recorder = &callRecorder;
+    __block SourceActivityTracker *activity = &sourceActivity;
+    __block BusSourceTable<MAX_NUM_SOURCES> *busSourceTable = &busSources;
+    __block RenderAheadPipeline *ahead = &renderAhead;
+    __block OutputRecorder *outputCapture = &outputRecorder;
     return ^AUAudioUnitStatus(AudioUnitRenderActionFlags *actionFlags,
                               const AudioTimeStamp       *timestamp,
                               AVAudioFrameCount           frameCount,
@@ -260,16 +453,19 @@ struct BufferedInputBus : BufferedAudioBus {
             printf("LeiaAU - ERROR: frame count %d is more than preferred FRAME_COUNT %d\n", frameCount, FRAME_COUNT);
         }
 
-        // Prepare input buffers
-        const int kNumInputs = (int) [self.leiaSourceIds count];
+        // Prepare input buffers; input bus i feeds the source of entry i
+        const BusSourceTable<MAX_NUM_SOURCES>::Snapshot &sources = busSourceTable->acquire();
+        const int kNumInputs = sources.count;
+        const float *hostInputs[MAX_NUM_SOURCES];
+        int sourceIds[MAX_NUM_SOURCES];
         for (int i = 0; i < kNumInputs; ++i) {
           AudioUnitRenderActionFlags kPullFlags = 0;
           AUAudioUnitStatus err = inputBusses[i].pullInput(&kPullFlags, timestamp, frameCount, i, pullInputBlock);
           assert(err == 0 && "Error while pulling data from input buffers.");
-          leia_source_audio_update(self.leiaEngine, (int)[self.leiaSourceIds[i] integerValue],
-                                   (float *) inputBusses[i].mutableAudioBufferList->mBuffers[0].mData,
-                                   (int) frameCount);
+          hostInputs[i] = (const float *) inputBusses[i].mutableAudioBufferList->mBuffers[0].mData;
+          sourceIds[i] = sources.entries[i].sourceId;
         }
+        outputCapture->captureBusInputs(sourceIds, hostInputs, kNumInputs, (int) frameCount);
 
         // Prepare output buffers
         float *outBuffers[2] = {
@@ -277,8 +473,70 @@ struct BufferedInputBus : BufferedAudioBus {
             (float *) outputData->mBuffers[1].mData
         };
 
-        // Process Leia
-        leia_process_source_audio(self.leiaEngine, outBuffers, (int) frameCount);
+        // Rendering ahead, the engine runs on a worker thread; queue the bus input to it, and take its output from the FIFO
+        if (ahead->enabled()) {
+            int activitySlots[MAX_NUM_SOURCES];
+            for (int i = 0; i < kNumInputs; ++i) {
+                activitySlots[i] = sources.entries[i].activitySlot;
+            }
+            if (!converter->enabled) {
+                ahead->queueBusInputs(kNumInputs, sourceIds, activitySlots, hostInputs, (int) frameCount);
+                ahead->read(outBuffers, (int) frameCount);
+            } else {
+                const int engineFrames = converter->convertInputs(hostInputs, sourceIds, kNumInputs, frameCount);
+                const float *engineInputs[MAX_NUM_SOURCES];
+                for (int i = 0; i < kNumInputs; ++i) {
+                    engineInputs[i] = converter->engineInputChannel(i);
+                }
+                ahead->queueBusInputs(kNumInputs, sourceIds, activitySlots, engineInputs, engineFrames);
+                float *engineOutBuffers[2] = { converter->engineOutputChannel(0), converter->engineOutputChannel(1) };
+                ahead->read(engineOutBuffers, engineFrames);
+                converter->convertOutput(engineFrames, outBuffers, frameCount);
+            }
+            busSourceTable->release();
+            outputCapture->captureOutput(outBuffers, (int) frameCount);
+            return noErr;
+        }
+
+        if (!converter->enabled) {
+            // Process Leia
+            for (int i = 0; i < kNumInputs; ++i) {
+                const int sourceId = sources.entries[i].sourceId;
+                if (!activity->process(self.leiaEngine, sources.entries[i].activitySlot, hostInputs[i], (int) frameCount)) { continue; }
+                recorder->recordAudio(sourceId, hostInputs[i], (int) frameCount);
+                leia_source_audio_update(self.leiaEngine, sourceId, (float *) hostInputs[i], (int) frameCount);
+            }
+            streamer->feedEngine(self.leiaEngine, (int) frameCount, activity, recorder);
+            recorder->recordProcess((int) frameCount);
+            leia_process_source_audio(self.leiaEngine, outBuffers, (int) frameCount);
+            streamer->advance();
+            busSourceTable->release();
+            outputCapture->captureOutput(outBuffers, (int) frameCount);
+            return noErr;
+        }
+
+        // Process Leia at the engine sample rate, in blocks of at most FRAME_COUNT frames
+        const int engineFrames = converter->convertInputs(hostInputs, sourceIds, kNumInputs, frameCount);
+        for (int offset = 0; offset < engineFrames; offset += FRAME_COUNT) {
+            const int n = std::min((int) FRAME_COUNT, engineFrames - offset);
+            for (int i = 0; i < kNumInputs; ++i) {
+                const int sourceId = sources.entries[i].sourceId;
+                if (!activity->process(self.leiaEngine, sources.entries[i].activitySlot, converter->engineInputChannel(i) + offset, n)) { continue; }
+                recorder->recordAudio(sourceId, converter->engineInputChannel(i) + offset, n);
+                leia_source_audio_update(self.leiaEngine, sourceId, converter->engineInputChannel(i) + offset, n);
+            }
+            float *engineOutBuffers[2] = {
+                converter->engineOutputChannel(0) + offset,
+                converter->engineOutputChannel(1) + offset
+            };
+            streamer->feedEngine(self.leiaEngine, n, activity, recorder);
+            recorder->recordProcess(n);
+            leia_process_source_audio(self.leiaEngine, engineOutBuffers, n);
+            streamer->advance();
+        }
+        converter->convertOutput(engineFrames, outBuffers, frameCount);
+        busSourceTable->release();
+        outputCapture->captureOutput(outBuffers, (int) frameCount);
 
         return noErr;
     };
@@ -312,6 +570,8 @@ struct BufferedInputBus : BufferedAudioBus {
 - (void) setLeiaAuListenerPosition: (float) x :(float) y :(float) z {
     [self.leiaAUViewController updateListenerPositionWithX:x y:y z:z];
     [self scnToLeiaPosition:(&x):(&y):(&z)];
+    sourceActivity.setListenerPosition(x, y, z);
+    callRecorder.record(LEIA_CALL_LISTENER_POSITION_UPDATE, 0, 3, x, y, z);
     leia_listener_position_update(self.leiaEngine, x, y, z);
 }
 
@@ -319,6 +579,7 @@ struct BufferedInputBus : BufferedAudioBus {
 - (void) setLeiaAuListenerOrientationQuaternion: (float) w :(float) x :(float) y :(float) z {
     [self.leiaAUViewController updateListenerOrientationWithW:w x:x y:y z:z];
     [self scnToLeiaOrientation: &w :&x :&y : &z];
+    callRecorder.record(LEIA_CALL_LISTENER_ORIENTATION_UPDATE, 0, 4, w, x, y, z);
     leia_listener_orientation_update(self.leiaEngine, w, x, y, z);
 }
 
@@ -328,6 +589,7 @@ struct BufferedInputBus : BufferedAudioBus {
     float w, x, y, z;
     leia_orientation_quaternion_convert(yaw, pitch, roll, &w, &x, &y, &z);
     [self.leiaAUViewController updateListenerOrientationWithW:w x:x y:y z:z];
+    callRecorder.record(LEIA_CALL_LISTENER_ORIENTATION_UPDATE, 0, 4, w, x, y, z);
     leia_listener_orientation_update(self.leiaEngine, w, x, y, z);
 }
 
@@ -335,58 +597,175 @@ struct BufferedInputBus : BufferedAudioBus {
 - (void) addLeiaAuSource: (int) sourceId :(float) x :(float) y :(float) z {
     simd_float3 scn = simd_make_float3(x, y, z);
     [self scnToLeiaPosition:(&x):(&y):(&z)];
-    leia_source_add(self.leiaEngine, sourceId, x, y, z);
-    [self.leiaSourceIds addObject:[NSNumber numberWithInt:sourceId]];
+    if (busSources.current().count == MAX_NUM_SOURCES) {
+        printf("LeiaAU - ERROR: all %d input busses are in use; LeiaSource with ID %d not added.\n", MAX_NUM_SOURCES, sourceId);
+        return;
+    }
+    busSources.add(sourceId, sourceActivity.add(self.leiaEngine, sourceId, x, y, z, false));
     printf("LeiaAU - LeiaSource with ID %d added.\n", sourceId);
     [self.leiaAUViewController numSourcesChanged];
     [self.leiaAUViewController updateSourcePositionWithId:sourceId x:scn[0] y:scn[1] z:scn[2]];
 }
 
+/** Add a LeiaSource whose audio is streamed from a file to the Leia system. */
+- (BOOL) addLeiaAuStreamingSource: (int) sourceId :(NSString *) path :(BOOL) loop :(float) x :(float) y :(float) z {
+    simd_float3 scn = simd_make_float3(x, y, z);
+    [self scnToLeiaPosition:(&x):(&y):(&z)];
+    const int activitySlot = sourceActivity.add(self.leiaEngine, sourceId, x, y, z, true);
+    if (!sourceStreamer.add(sourceId, [path fileSystemRepresentation], loop, activitySlot)) {
+        sourceActivity.release(sourceActivity.remove(self.leiaEngine, sourceId));
+        return NO;
+    }
+    printf("LeiaAU - Streaming LeiaSource with ID %d added.\n", sourceId);
+    [self.leiaAUViewController updateSourcePositionWithId:sourceId x:scn[0] y:scn[1] z:scn[2]];
+    return YES;
+}
+
 /** Remove a LeiaSource with the given ID from the Leia system */
 - (void) removeLeiaAuSource: (int) sourceId {
-    [self.leiaSourceIds removeObject:[NSNumber numberWithInt:sourceId]];
-    leia_source_remove(self.leiaEngine, sourceId);
+    // The render thread skips a source as soon as it is removed from the activity tracker. The decode thread
+    // releases a streaming source's activity slot, once the render thread has let go of the source.
+    const int activitySlot = sourceActivity.remove(self.leiaEngine, sourceId);
+    if (!sourceStreamer.remove(sourceId)) {
+        busSources.remove(sourceId);
+        sourceActivity.release(activitySlot);
+    }
     [self.leiaAUViewController numSourcesChanged];
     printf("LeiaAU - LeiaSource with ID %d removed.\n", sourceId);
 }
 
-/** Get the array of LeiaSource IDs. */
+/** Get the number of blocks a streaming LeiaSource was not decoded in time. */
+- (int) getLeiaAuStreamingSourceUnderruns: (int) sourceId {
+    return (int) sourceStreamer.underrunCount(sourceId);
+}
+
+/** Get the number of sources, counting input bus and streaming sources. */
+- (int) getLeiaAuRegisteredSourceCount {
+    return sourceActivity.registeredCount();
+}
+
+/** Get the number of sources the engine processes; silent streaming sources are taken out of it. */
+- (int) getLeiaAuActiveSourceCount {
+    return sourceActivity.activeCount();
+}
+
+/** Enable or disable taking silent streaming sources out of the engine. */
+- (void) setLeiaAuSilentSourceSkipping: (BOOL) enabled {
+    sourceActivity.setEnabled(enabled);
+}
+
+/** Start recording all Leia engine calls to a log file, which Tools/LeiaAUReplay.cpp replays. */
+- (BOOL) startLeiaAuCallRecording: (NSString *) path :(LeiaAuCallAudio) audio {
+    if (!callRecorder.start([path fileSystemRepresentation], SAMPLE_RATE, FRAME_COUNT, (CallAudioMode) audio)) {
+        printf("LeiaAU - ERROR: could not create call log %s.\n", [path fileSystemRepresentation]);
+        return NO;
+    }
+    printf("LeiaAU - Recording Leia calls to %s.\n", [path fileSystemRepresentation]);
+    return YES;
+}
+
+/** Stop recording Leia engine calls and close the log file. */
+- (void) stopLeiaAuCallRecording {
+    callRecorder.stop();
+}
+
+/** Reserve memory for the given number of streaming LeiaSources, so adding and removing them does not allocate. */
+- (BOOL) reserveLeiaAuSources: (int) count {
+    if (count > MAX_NUM_STREAMING_SOURCES || !sourceStreamer.reserve(count)) {
+        printf("LeiaAU - ERROR: could not reserve %d streaming LeiaSources.\n", count);
+        return NO;
+    }
+    printf("LeiaAU - Reserved %d streaming LeiaSources.\n", count);
+    return YES;
+}
+
+/** Render streaming LeiaSources the given number of blocks ahead of the audio callback, or 0 to render in the callback. */
+- (BOOL) setLeiaAuRenderAheadBlocks: (int) blocks {
+    if (self.renderResourcesAllocated || blocks < 0 || (blocks > 0 && blocks < MIN_RENDER_AHEAD_BLOCKS) || blocks > MAX_RENDER_AHEAD_BLOCKS) {
+        printf("LeiaAU - ERROR: could not render %d blocks ahead.\n", blocks);
+        return NO;
+    }
+    renderAhead.setBlocks(blocks);
+    return YES;
+}
+
+/** Get the number of audio callbacks for which the blocks rendered ahead did not suffice. */
+- (int) getLeiaAuRenderAheadUnderruns {
+    return (int) renderAhead.underruns.load();
+}
+
+/** Start recording LeiaAU's output, and optionally the input of each input bus source, to audio files. */
+- (BOOL) startLeiaAuOutputRecording: (NSString *) path :(BOOL) busInputs :(LeiaAuRecordingFormat) format {
+    const double sampleRate = self.outputBus.format.sampleRate;
+    if (!outputRecorder.start([path fileSystemRepresentation], busInputs, sampleRate, (RecordingFileType) format)) {
+        printf("LeiaAU - ERROR: already recording the output.\n");
+        return NO;
+    }
+    printf("LeiaAU - Recording the output to %s.\n", [path fileSystemRepresentation]);
+    return YES;
+}
+
+/** Stop recording LeiaAU's output, and complete the files. */
+- (void) stopLeiaAuOutputRecording {
+    if (!outputRecorder.isActive()) { return; }
+    outputRecorder.stop();
+    printf("LeiaAU - Stopped recording the output; %llu frames were dropped.\n", (unsigned long long) outputRecorder.droppedFrames());
+}
+
+/** Get the number of frames dropped from the output recording, because the disk could not keep up. */
+- (int) getLeiaAuOutputRecordingDroppedFrames {
+    return (int) outputRecorder.droppedFrames();
+}
+
+/** Get the array of LeiaSource IDs of the input busses, in bus order. */
 - (NSArray *) getLeiaAuSourceIds {
-    return self.leiaSourceIds;
+    const BusSourceTable<MAX_NUM_SOURCES>::Snapshot &sources = busSources.current();
+    NSMutableArray *sourceIds = [NSMutableArray arrayWithCapacity:sources.count];
+    for (int i = 0; i < sources.count; ++i) {
+        [sourceIds addObject:[NSNumber numberWithInt:sources.entries[i].sourceId]];
+    }
+    return sourceIds;
 }
 
 /** Set the position of the LeiaSource with the given ID */
 - (void) setLeiaAuSourcePosition: (int) sourceId :(float) x :(float) y :(float) z {
     [self.leiaAUViewController updateSourcePositionWithId:sourceId x:x y:y z:z];
     [self scnToLeiaPosition:(&x):(&y):(&z)];
-    leia_source_position_update(self.leiaEngine, sourceId, x, y, z);
+    sourceActivity.setPosition(self.leiaEngine, sourceId, x, y, z);
 }
 
 /** Set the global minimum distance between listener and source to prevent high volumes / clipping */
 - (void) setLeiaAuSourceMinimumDistanceGainLimit: (int) sourceId :(float) min_distance {
-    leia_source_minimum_distance_gain_limit_set(self.leiaEngine, sourceId, min_distance);
+    sourceActivity.setMinimumDistance(self.leiaEngine, sourceId, min_distance);
 }
 
 /** Set the gain of the latefield (linear scale) */
 - (void) setLeiaAuLatefieldGain: (float) gain {
+    callRecorder.record(LEIA_CALL_GAIN_LATEFIELD_SET, 0, 1, gain);
     leia_gain_latefield_set(self.leiaEngine, gain);
 }
 
 /** Set the gain of the reflections (linear scale) */
 - (void) setLeiaAuReflectionsGain: (float) gain {
+    callRecorder.record(LEIA_CALL_GAIN_REFLECTIONS_SET, 0, 1, gain);
     leia_gain_reflections_set(self.leiaEngine, gain);
 }
 
 /** Set the current acoustic environment to be a Freefield */
 - (void) setLeiaAuEnvironmentFreefield {
+    callRecorder.record(LEIA_CALL_ENVIRONMENT_FREEFIELD_SET);
     leia_environment_freefield_set(self.leiaEngine);
+    sourceActivity.setFreefieldEnvironment();
     [[self.leiaAUViewController environmentSegmentedControl] setSelectedSegmentIndex:0];
 }
 
 /** Set the current acoustic environment to be a Shoebox room */
 - (void) setLeiaAuEnvironmentShoebox: (float) width :(float) length :(float) height {
     [self fmaxDimensions:(&width):(&length):(&height):0.01];
+    callRecorder.record(LEIA_CALL_ENVIRONMENT_SHOEBOX_SET, 0, 3, width, length, height);
     leia_environment_shoebox_set(self.leiaEngine, width, length, height);
+    sourceActivity.setShoeboxEnvironment(width, length, height);
+    callRecorder.record(LEIA_CALL_GAIN_LATEFIELD_SET, 0, 1, 2.0);
     leia_gain_latefield_set(self.leiaEngine, 2.0); // default to +6 db Gain
     [[self.leiaAUViewController environmentSegmentedControl] setSelectedSegmentIndex:1];
 }
@@ -394,24 +773,29 @@ struct BufferedInputBus : BufferedAudioBus {
 /** Set the current Shoebox room's dimensions */
 - (void) setLeiaAuEnvironmentShoeboxDimensions: (float) width :(float) length :(float) height {
     [self fmaxDimensions:(&width):(&length):(&height):0.01];
+    callRecorder.record(LEIA_CALL_ENVIRONMENT_SHOEBOX_DIMENSIONS_UPDATE, 0, 3, width, length, height);
     leia_environment_shoebox_dimensions_update(self.leiaEngine, width, length, height);
+    sourceActivity.setShoeboxEnvironment(width, length, height);
 }
 
 /** Set the material on a Shoebox surface */
 - (void) setLeiaAuEnvironmentShoeboxReflectionMaterialForPath: (int) surfaceId : (NSString *) materialId {
     const char *cString = [materialId cStringUsingEncoding:NSASCIIStringEncoding];
+    callRecorder.recordText(LEIA_CALL_ENVIRONMENT_SHOEBOX_MATERIAL_UPDATE, surfaceId, cString);
     leia_environment_shoebox_material_update(self.leiaEngine, (LeiaSurfaceID) surfaceId, cString);
 }
 
 /** Set the origin of the Shoebox (corner at the intersection of LEFT, BACK, and FLOOR surfaces) */
 - (void) setLeiaAuEnvironmentShoeboxOrigin: (float) x :(float) y :(float) z {
     [self scnToLeiaPosition:(&x):(&y):(&z)];
+    callRecorder.record(LEIA_CALL_ENVIRONMENT_ORIGIN_UPDATE, 0, 3, x, y, z);
     leia_environment_origin_update(self.leiaEngine, x, y, z);
 }
 
 /** Set the orientation of the Shoebox with quaternion */
 - (void) setLeiaAuEnvironmentShoeboxOrientationQuaternion: (float) w :(float) x :(float) y :(float) z {
     [self scnToLeiaOrientation:(&w):(&x):(&y):(&z)];
+    callRecorder.record(LEIA_CALL_ENVIRONMENT_ORIENTATION_UPDATE, 0, 4, w, x, y, z);
     leia_environment_orientation_update(self.leiaEngine, w, x, y, z);
 }
 
@@ -420,6 +804,7 @@ struct BufferedInputBus : BufferedAudioBus {
     [self arkitToLeiaEuler:(&yaw) :(&pitch) :(&roll)];
     float w, x, y, z;
     leia_orientation_quaternion_convert(yaw, pitch, roll, &w, &x, &y, &z);
+    callRecorder.record(LEIA_CALL_ENVIRONMENT_ORIENTATION_UPDATE, 0, 4, w, x, y, z);
     leia_environment_orientation_update(self.leiaEngine, w, x, y, z);
 }
 
@@ -0,0 +1,483 @@
+/**
+ * Copyright (c) Sennheiser Electronic GmbH & Co. KG, 2018. All Rights Reserved.
+ *
+ * Distributed as part of the AMBEO Augmented Audio Developers Program.
+ * You may only use this code under the terms stated in LICENSE.md, which was distributed alongside this code.
+ */
+
+#ifndef LeiaAUCallRecorder_h
+#define LeiaAUCallRecorder_h
+
+#include "LeiaAURingBuffer.h"
+#include "SennheiserAmbeoLeia.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Layout of a Leia call log: a CallLogHeader followed by CallRecords, in the order the calls were made.
+ * With CALL_AUDIO_SAMPLES, an audio update whose count is 1 is directly followed by its `frames` samples.
+ * The first records, all at block 0, recreate the scene as it was when recording started.
+ * The log is written by CallRecorder and replayed by Tools/LeiaAUReplay.cpp.
+ */
+
+static const uint32_t CALL_LOG_MAGIC = 0x4c43414c; // 'LCAL'
+static const uint32_t CALL_LOG_VERSION = 3;
+static const int CALL_RECORD_MAX_VALUES = 10;
+static const size_t CALL_SAMPLE_RING_FRAMES = 1 << 21;  // samples buffered until the writer catches up, about 6 s of 8 sources
+
+/** The recorded Leia API calls. */
+typedef enum {
+    LEIA_CALL_SOURCE_ADD = 1,                  // sourceId, values: x, y, z
+    LEIA_CALL_SOURCE_REMOVE,                   // sourceId
+    LEIA_CALL_SOURCE_AUDIO_UPDATE,             // sourceId, frames, payload: hash of the samples (unless CALL_AUDIO_NONE),
+                                               // count: 1 if the samples follow the record
+    LEIA_CALL_SOURCE_POSITION_UPDATE,          // sourceId, values: x, y, z
+    LEIA_CALL_SOURCE_MINIMUM_DISTANCE_SET,     // sourceId, values: distance
+    LEIA_CALL_LISTENER_POSITION_UPDATE,        // values: x, y, z
+    LEIA_CALL_LISTENER_ORIENTATION_UPDATE,     // values: w, x, y, z
+    LEIA_CALL_GAIN_LATEFIELD_SET,              // values: gain
+    LEIA_CALL_GAIN_REFLECTIONS_SET,            // values: gain
+    LEIA_CALL_ENVIRONMENT_FREEFIELD_SET,
+    LEIA_CALL_ENVIRONMENT_SHOEBOX_SET,         // values: width, length, height
+    LEIA_CALL_ENVIRONMENT_SHOEBOX_DIMENSIONS_UPDATE, // values: width, length, height
+    LEIA_CALL_ENVIRONMENT_SHOEBOX_MATERIAL_UPDATE,   // sourceId: surface id, text: material name
+    LEIA_CALL_ENVIRONMENT_ORIGIN_UPDATE,       // values: x, y, z
+    LEIA_CALL_ENVIRONMENT_ORIENTATION_UPDATE,  // values: w, x, y, z
+    LEIA_CALL_PROCESS_SOURCE_AUDIO             // frames
+} LeiaCall;
+
+/** How much of the source audio is recorded with each LEIA_CALL_SOURCE_AUDIO_UPDATE. */
+typedef enum {
+    CALL_AUDIO_NONE = 0,
+    CALL_AUDIO_HASH,     // a 64 bit FNV-1a hash of the samples, to verify a replay's input
+    CALL_AUDIO_SAMPLES   // the hash, and the samples, after each update; about 10 MB per source and minute
+} CallAudioMode;
+
+struct CallLogHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sampleRate;
+    uint32_t maxBlockSize;
+    uint32_t audioMode;
+    uint32_t reserved;
+    uint64_t droppedRecords;  // records lost because the writer fell behind
+};
+
+struct CallRecord {
+    uint16_t call;            // a LeiaCall
+    uint16_t count;           // number of valid entries in values
+    int32_t sourceId;
+    uint64_t block;           // number of blocks processed before the call
+    int32_t frames;
+    int32_t reserved;
+    union {
+        float values[CALL_RECORD_MAX_VALUES];
+        char text[CALL_RECORD_MAX_VALUES * sizeof(float)];
+        struct {
+            uint64_t hash;
+            uint64_t samplePosition;  // where the samples start in CallRecorder's sample ring; 0 in the log
+        } audio;
+    } payload;
+};
+
+static_assert(sizeof(CallLogHeader) == 32, "CallLogHeader layout must not change within a version.");
+static_assert(sizeof(CallRecord) == 64, "CallRecord layout must not change within a version.");
+
+static inline uint64_t fnv1aHash(const void* data, size_t byteSize) {
+    const uint8_t* bytes = (const uint8_t*) data;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < byteSize; ++i) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/** @return the number of values a scene call takes, or -1 if `call` is not a scene call. */
+static inline int sceneCallValueCount(uint16_t call) {
+    switch (call) {
+        case LEIA_CALL_SOURCE_REMOVE:
+        case LEIA_CALL_ENVIRONMENT_FREEFIELD_SET:
+        case LEIA_CALL_ENVIRONMENT_SHOEBOX_MATERIAL_UPDATE:
+            return 0;
+        case LEIA_CALL_SOURCE_MINIMUM_DISTANCE_SET:
+        case LEIA_CALL_GAIN_LATEFIELD_SET:
+        case LEIA_CALL_GAIN_REFLECTIONS_SET:
+            return 1;
+        case LEIA_CALL_SOURCE_ADD:
+        case LEIA_CALL_SOURCE_POSITION_UPDATE:
+        case LEIA_CALL_LISTENER_POSITION_UPDATE:
+        case LEIA_CALL_ENVIRONMENT_SHOEBOX_SET:
+        case LEIA_CALL_ENVIRONMENT_SHOEBOX_DIMENSIONS_UPDATE:
+        case LEIA_CALL_ENVIRONMENT_ORIGIN_UPDATE:
+            return 3;
+        case LEIA_CALL_LISTENER_ORIENTATION_UPDATE:
+        case LEIA_CALL_ENVIRONMENT_ORIENTATION_UPDATE:
+            return 4;
+        default:
+            return -1;
+    }
+}
+
+/**
+ * Checks a scene call from an untrusted source, such as another process, before it is applied:
+ * the call must be a scene call with its number of values, all finite, and name a valid surface.
+ * Terminates the text of a material update.
+ *
+ * @return false if the call must not be applied.
+ */
+static inline bool validateSceneCall(CallRecord& r) {
+    if (sceneCallValueCount(r.call) != r.count) { return false; }
+    for (int i = 0; i < r.count; ++i) {
+        if (!std::isfinite(r.payload.values[i])) { return false; }
+    }
+    if (r.call == LEIA_CALL_ENVIRONMENT_SHOEBOX_MATERIAL_UPDATE) {
+        r.payload.text[sizeof(r.payload.text) - 1] = '\0';
+        return r.sourceId >= SURFACE_DIRECT && r.sourceId <= SURFACE_FLOOR;
+    }
+    return true;
+}
+
+/**
+ * Makes a recorded call that changes the engine's scene state, i.e. any call except the
+ * audio updates and processing.
+ *
+ * @return false if the record is not such a call.
+ */
+static inline bool applyCall(LeiaInstance* leia, const CallRecord& r) {
+    const float* v = r.payload.values;
+    switch (r.call) {
+        case LEIA_CALL_SOURCE_ADD: leia_source_add(leia, r.sourceId, v[0], v[1], v[2]); return true;
+        case LEIA_CALL_SOURCE_REMOVE: leia_source_remove(leia, r.sourceId); return true;
+        case LEIA_CALL_SOURCE_POSITION_UPDATE: leia_source_position_update(leia, r.sourceId, v[0], v[1], v[2]); return true;
+        case LEIA_CALL_SOURCE_MINIMUM_DISTANCE_SET: leia_source_minimum_distance_gain_limit_set(leia, r.sourceId, v[0]); return true;
+        case LEIA_CALL_LISTENER_POSITION_UPDATE: leia_listener_position_update(leia, v[0], v[1], v[2]); return true;
+        case LEIA_CALL_LISTENER_ORIENTATION_UPDATE: leia_listener_orientation_update(leia, v[0], v[1], v[2], v[3]); return true;
+        case LEIA_CALL_GAIN_LATEFIELD_SET: leia_gain_latefield_set(leia, v[0]); return true;
+        case LEIA_CALL_GAIN_REFLECTIONS_SET: leia_gain_reflections_set(leia, v[0]); return true;
+        case LEIA_CALL_ENVIRONMENT_FREEFIELD_SET: leia_environment_freefield_set(leia); return true;
+        case LEIA_CALL_ENVIRONMENT_SHOEBOX_SET: leia_environment_shoebox_set(leia, v[0], v[1], v[2]); return true;
+        case LEIA_CALL_ENVIRONMENT_SHOEBOX_DIMENSIONS_UPDATE: leia_environment_shoebox_dimensions_update(leia, v[0], v[1], v[2]); return true;
+        case LEIA_CALL_ENVIRONMENT_SHOEBOX_MATERIAL_UPDATE:
+            leia_environment_shoebox_material_update(leia, (LeiaSurfaceID) r.sourceId, r.payload.text);
+            return true;
+        case LEIA_CALL_ENVIRONMENT_ORIGIN_UPDATE: leia_environment_origin_update(leia, v[0], v[1], v[2]); return true;
+        case LEIA_CALL_ENVIRONMENT_ORIENTATION_UPDATE: leia_environment_orientation_update(leia, v[0], v[1], v[2], v[3]); return true;
+        default: return false;
+    }
+}
+
+#pragma mark - CallRecorder
+
+/**
+ * CallRecorder logs Leia API calls to a file while recording is active.
+ *
+ * Records go into a bounded lock-free queue (multiple producers), and a background thread writes
+ * them to disk in large chunks. Recorded samples go into a lock-free ring of their own, which the
+ * writer copies into the log right after their audio update, so the log holds each sample once.
+ * If the queue or the ring is full, records or samples are dropped and counted instead of
+ * blocking the caller. While recording is inactive, recording audio or a process call costs one
+ * atomic load.
+ *
+ * record() and recordText() also keep the latest state of the scene, active or not, so that a
+ * recording started mid-session begins with the listener, environment and sources as they are.
+ * They lock a mutex and may allocate, so scene calls must not be recorded on the audio thread;
+ * recordAudio() and recordProcess() are real-time safe.
+ */
+struct CallRecorder {
+
+    static const size_t QUEUE_CAPACITY = 1 << 16;  // records
+    static const size_t WRITE_CHUNK = 256;         // records per fwrite
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        CallRecord record;
+    };
+
+    std::vector<Cell> cells;
+    SampleRingBuffer samples;                 // producer: the thread calling recordAudio()
+    std::atomic<size_t> enqueuePosition{0};
+    std::atomic<size_t> dequeuePosition{0};
+    std::atomic<bool> active{false};
+    std::atomic<int> producers{0};            // calls currently between the active check and the enqueue
+    std::atomic<uint64_t> droppedRecords{0};
+    std::atomic<uint64_t> blocks{0};
+    CallAudioMode audioMode = CALL_AUDIO_NONE;
+    FILE* file = nullptr;
+    CallLogHeader header = {};
+    std::thread writerThread;
+    std::atomic<bool> writerRunning{false};
+
+    /** The latest scene call for each piece of scene state, by sceneKey(), with the order it was made in. */
+    std::map<uint64_t, std::pair<uint64_t, CallRecord>> scene;
+    uint64_t sceneSequence = 0;
+    std::mutex sceneMutex;
+
+    ~CallRecorder() {
+        stop();
+    }
+
+    /** Starts recording to a new file. Allocates; do not call on the audio thread. */
+    bool start(const char* path, uint32_t sampleRate, uint32_t maxBlockSize, CallAudioMode mode) {
+        stop();
+        file = fopen(path, "wb");
+        if (file == nullptr) { return false; }
+        if (cells.empty()) {
+            cells = std::vector<Cell>(QUEUE_CAPACITY);
+        }
+        for (size_t i = 0; i < QUEUE_CAPACITY; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        if (mode == CALL_AUDIO_SAMPLES && samples.capacity == 0) {
+            samples.init(CALL_SAMPLE_RING_FRAMES, 0);
+        }
+        samples.clear();
+        enqueuePosition.store(0, std::memory_order_relaxed);
+        dequeuePosition.store(0, std::memory_order_relaxed);
+        droppedRecords.store(0);
+        blocks.store(0);
+        audioMode = mode;
+
+        header = CallLogHeader{CALL_LOG_MAGIC, CALL_LOG_VERSION, sampleRate, maxBlockSize, (uint32_t) mode, 0, 0};
+        fwrite(&header, sizeof(header), 1, file);
+
+        // Scene calls wait while the snapshot is written, so each is either in it or recorded after it.
+        std::lock_guard<std::mutex> lock(sceneMutex);
+        writeSceneSnapshot();
+        writerRunning.store(true);
+        writerThread = std::thread([this] { writeLoop(); });
+        active.store(true, std::memory_order_release);
+        return true;
+    }
+
+    /** Stops recording, writes all queued records and closes the file. */
+    void stop() {
+        if (!active.exchange(false)) { return; }
+        while (producers.load() != 0) { std::this_thread::yield(); }
+        writerRunning.store(false);
+        writerThread.join();
+
+        header.droppedRecords = droppedRecords.load();
+        fseek(file, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, file);
+        fclose(file);
+        file = nullptr;
+    }
+
+    bool isActive() const {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    /** Records a scene call. Not on the audio thread. */
+    void record(LeiaCall call, int sourceId = 0, int count = 0,
+                float v0 = 0.0f, float v1 = 0.0f, float v2 = 0.0f, float v3 = 0.0f) {
+        CallRecord r = makeRecord(call, sourceId, 0);
+        r.count = (uint16_t) count;
+        r.payload.values[0] = v0;
+        r.payload.values[1] = v1;
+        r.payload.values[2] = v2;
+        r.payload.values[3] = v3;
+        recordScene(r);
+    }
+
+    /** Records a scene call with a text argument. Not on the audio thread. */
+    void recordText(LeiaCall call, int sourceId, const char* text) {
+        CallRecord r = makeRecord(call, sourceId, 0);
+        strncpy(r.payload.text, text, sizeof(r.payload.text) - 1);
+        recordScene(r);
+    }
+
+    /**
+     * Records an audio update. Called by one thread at a time: the thread that renders the engine,
+     * as the samples pass through a single producer ring.
+     */
+    void recordAudio(int sourceId, const float* buffer, int n) {
+        if (!isActive()) { return; }
+        CallRecord r = makeRecord(LEIA_CALL_SOURCE_AUDIO_UPDATE, sourceId, n);
+        if (audioMode != CALL_AUDIO_NONE) {
+            r.payload.audio.hash = fnv1aHash(buffer, n * sizeof(float));
+        }
+        if (audioMode == CALL_AUDIO_SAMPLES) {
+            // If the record is then dropped, the writer skips its samples by their position.
+            if (samples.writable() >= (size_t) n) {
+                r.count = 1;
+                r.payload.audio.samplePosition = samples.writeIndex.load(std::memory_order_relaxed);
+                samples.write(buffer, (size_t) n);
+            } else {
+                droppedRecords.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        enqueue(r);
+    }
+
+    /**
+     * Records a call of leia_process_source_audio(), which ends a block. Called by the thread that
+     * renders the engine: the audio callback, or the RenderAheadPipeline worker while rendering ahead.
+     */
+    void recordProcess(int n) {
+        if (isActive()) {
+            enqueue(makeRecord(LEIA_CALL_PROCESS_SOURCE_AUDIO, 0, n));
+        }
+        blocks.fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+
+    /** Identifies the scene state a call sets: calls with equal keys overwrite each other. */
+    static uint64_t sceneKey(LeiaCall call, int sourceId) {
+        switch (call) {
+            case LEIA_CALL_ENVIRONMENT_SHOEBOX_SET: call = LEIA_CALL_ENVIRONMENT_FREEFIELD_SET; break;
+            case LEIA_CALL_SOURCE_ADD:
+            case LEIA_CALL_SOURCE_POSITION_UPDATE:
+            case LEIA_CALL_SOURCE_MINIMUM_DISTANCE_SET:
+            case LEIA_CALL_ENVIRONMENT_SHOEBOX_MATERIAL_UPDATE:
+                return (uint64_t) call << 32 | (uint32_t) sourceId;
+            default: break;
+        }
+        return (uint64_t) call << 32;
+    }
+
+    void recordScene(const CallRecord& r) {
+        std::lock_guard<std::mutex> lock(sceneMutex);
+        const LeiaCall call = (LeiaCall) r.call;
+        if (call == LEIA_CALL_SOURCE_REMOVE) {
+            scene.erase(sceneKey(LEIA_CALL_SOURCE_ADD, r.sourceId));
+            scene.erase(sceneKey(LEIA_CALL_SOURCE_POSITION_UPDATE, r.sourceId));
+            scene.erase(sceneKey(LEIA_CALL_SOURCE_MINIMUM_DISTANCE_SET, r.sourceId));
+        } else {
+            scene[sceneKey(call, r.sourceId)] = std::make_pair(sceneSequence++, r);
+        }
+        if (isActive()) {
+            enqueue(r);
+        }
+    }
+
+    /**
+     * Writes the scene state as the calls that set it, in the order they were made, at block 0,
+     * followed by a silent audio update for each source: the engine keeps playing the last buffer
+     * a source was given, which the log does not have, until the source's next update.
+     */
+    void writeSceneSnapshot() {
+        std::vector<std::pair<uint64_t, CallRecord>> calls;
+        for (const auto& entry : scene) {
+            calls.push_back(entry.second);
+        }
+        std::sort(calls.begin(), calls.end(), [](const std::pair<uint64_t, CallRecord>& a, const std::pair<uint64_t, CallRecord>& b) {
+            return a.first < b.first;
+        });
+        for (std::pair<uint64_t, CallRecord>& call : calls) {
+            call.second.block = 0;
+            fwrite(&call.second, sizeof(CallRecord), 1, file);
+        }
+
+        const std::vector<float> silence(header.maxBlockSize, 0.0f);
+        for (const std::pair<uint64_t, CallRecord>& call : calls) {
+            if (call.second.call != LEIA_CALL_SOURCE_ADD) { continue; }
+            CallRecord r = makeRecord(LEIA_CALL_SOURCE_AUDIO_UPDATE, call.second.sourceId, (int) silence.size());
+            r.block = 0;
+            if (audioMode != CALL_AUDIO_NONE) {
+                r.payload.audio.hash = fnv1aHash(silence.data(), silence.size() * sizeof(float));
+            }
+            r.count = audioMode == CALL_AUDIO_SAMPLES ? 1 : 0;
+            fwrite(&r, sizeof(CallRecord), 1, file);
+            if (r.count == 1) {
+                fwrite(silence.data(), sizeof(float), silence.size(), file);
+            }
+        }
+    }
+
+    CallRecord makeRecord(LeiaCall call, int sourceId, int frames) const {
+        CallRecord r;
+        memset(&r, 0, sizeof(r));
+        r.call = (uint16_t) call;
+        r.sourceId = sourceId;
+        r.block = blocks.load(std::memory_order_relaxed);
+        r.frames = frames;
+        return r;
+    }
+
+    /** Bounded multiple producer queue (D. Vyukov); never blocks. */
+    void enqueue(const CallRecord& r) {
+        producers.fetch_add(1, std::memory_order_acquire);
+        if (!active.load(std::memory_order_acquire)) {
+            producers.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+        size_t position = enqueuePosition.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[position & (QUEUE_CAPACITY - 1)];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+            if (difference == 0) {
+                if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.record = r;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    break;
+                }
+            } else if (difference < 0) {
+                droppedRecords.fetch_add(1, std::memory_order_relaxed);
+                break;
+            } else {
+                position = enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+        producers.fetch_sub(1, std::memory_order_release);
+    }
+
+    /** Single consumer: the writer thread. */
+    bool dequeue(CallRecord& r) {
+        size_t position = dequeuePosition.load(std::memory_order_relaxed);
+        Cell& cell = cells[position & (QUEUE_CAPACITY - 1)];
+        if (cell.sequence.load(std::memory_order_acquire) != position + 1) { return false; }
+        r = cell.record;
+        cell.sequence.store(position + QUEUE_CAPACITY, std::memory_order_release);
+        dequeuePosition.store(position + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /** Writer thread: writes a record, followed by its samples, if any. */
+    void writeRecord(CallRecord& r) {
+        const bool hasSamples = r.call == LEIA_CALL_SOURCE_AUDIO_UPDATE && r.count == 1;
+        const size_t position = r.payload.audio.samplePosition;
+        if (hasSamples) { r.payload.audio.samplePosition = 0; }
+        fwrite(&r, sizeof(CallRecord), 1, file);
+        if (!hasSamples) { return; }
+        // Skip the samples of records that were dropped from the queue.
+        samples.consume(position - samples.readIndex.load(std::memory_order_relaxed));
+        size_t remaining = (size_t) r.frames;
+        while (remaining > 0) {
+            // The ring has no guard region, so read it in up to two contiguous parts.
+            const size_t start = samples.readIndex.load(std::memory_order_relaxed) & (samples.capacity - 1);
+            const size_t part = std::min(remaining, samples.capacity - start);
+            fwrite(samples.readPointer(), sizeof(float), part, file);
+            samples.consume(part);
+            remaining -= part;
+        }
+    }
+
+    void writeLoop() {
+        std::vector<CallRecord> chunk(WRITE_CHUNK);
+        for (;;) {
+            const bool running = writerRunning.load();
+            size_t n = 0;
+            while (n < WRITE_CHUNK && dequeue(chunk[n])) { ++n; }
+            for (size_t i = 0; i < n; ++i) {
+                writeRecord(chunk[i]);
+            }
+            if (n == WRITE_CHUNK) { continue; }
+            if (!running) { break; } // everything enqueued before stop() has been written
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+};
+
+#endif /* LeiaAUCallRecorder_h */
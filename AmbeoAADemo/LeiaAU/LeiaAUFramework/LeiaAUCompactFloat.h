@@ -0,0 +1,186 @@
+/**
+ * Copyright (c) Sennheiser Electronic GmbH & Co. KG, 2018. All Rights Reserved.
+ *
+ * Distributed as part of the AMBEO Augmented Audio Developers Program.
+ * You may only use this code under the terms stated in LICENSE.md, which was distributed alongside this code.
+ */
+
+#ifndef LeiaAUCompactFloat_h
+#define LeiaAUCompactFloat_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define LEIA_AU_COMPACT_NEON 1
+#else
+#if defined(__AVX__) && defined(__F16C__)
+#define LEIA_AU_COMPACT_F16C 1
+#endif
+#if defined(__AVX2__) || defined(LEIA_AU_COMPACT_F16C)
+#include <immintrin.h>
+#endif
+#endif
+
+// Whether dotHalf() and dotInt8() are vectorized for this target.
+#if defined(LEIA_AU_COMPACT_NEON) || defined(LEIA_AU_COMPACT_F16C)
+#define LEIA_AU_COMPACT_HALF_SIMD 1
+#endif
+#if defined(LEIA_AU_COMPACT_NEON) || defined(__AVX2__)
+#define LEIA_AU_COMPACT_INT8_SIMD 1
+#endif
+
+/**
+ * Compact storage of filter coefficients, which halves (fp16) or quarters (int8) the memory
+ * a table occupies in the caches. Tables are converted once, when they are designed or baked;
+ * the kernels below convert them back to float on the fly, with NEON on arm64 and F16C/AVX2 on x86.
+ *
+ * Resampling with the filter banks of LeiaAUResampler.h, the output differs from that with float
+ * coefficients, relative to full scale, by about -80 dB RMS and -65 dB peak for half precision.
+ * For int8 with one scale per phase, it differs by about -45 dB RMS (-43 dB for some rates) and
+ * -31 dB peak (measured with LeiaAU/Tools/LeiaAUCompactBench.cpp). That is audible distortion on
+ * quiet passages, so int8 only suits sources where it is masked, such as speech over noise.
+ */
+
+#pragma mark - Scalar conversion
+
+/** @return the IEEE 754 half precision value nearest to f (ties to even). */
+static inline uint16_t floatToHalf(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const int32_t exponent = (int32_t) ((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (((bits >> 23) & 0xff) == 0xff) {              // infinity or NaN
+        return (uint16_t) (sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));
+    }
+    if (exponent >= 31) {                             // overflow
+        return (uint16_t) (sign | 0x7c00);
+    }
+    if (exponent <= 0) {                              // subnormal or zero
+        if (exponent < -10) { return (uint16_t) sign; }
+        mantissa |= 0x800000;
+        const int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        const uint32_t rest = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) { ++half; }
+        return (uint16_t) (sign | half);
+    }
+    uint32_t half = ((uint32_t) exponent << 10) | (mantissa >> 13);
+    const uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) { ++half; } // may carry into the exponent, as it should
+    return (uint16_t) (sign | half);
+}
+
+static inline float halfToFloat(uint16_t h) {
+    const uint32_t magnitude = h & 0x7fff;
+    uint32_t bits;
+    if (magnitude >= 0x7c00) {
+        bits = 0x7f800000 | ((magnitude & 0x3ff) << 13);        // infinity or NaN
+    } else if (magnitude >= 0x0400) {
+        bits = (magnitude << 13) + ((uint32_t) (127 - 15) << 23); // normal: rebias the exponent
+    } else {
+        const float f = (float) magnitude * 5.9604645e-8f;       // subnormal: mantissa * 2^-24, exactly
+        memcpy(&bits, &f, sizeof(bits));
+    }
+    bits |= (uint32_t) (h & 0x8000) << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+/**
+ * Quantizes n values to int8 with a common scale.
+ *
+ * @return the scale, such that values[i] ~= quantized[i] * scale.
+ */
+static inline float quantizeInt8(const float* values, int8_t* quantized, int n) {
+    float peak = 0.0f;
+    for (int i = 0; i < n; ++i) {
+        peak = std::max(peak, std::fabs(values[i]));
+    }
+    const float scale = peak > 0.0f ? peak / 127.0f : 1.0f;
+    for (int i = 0; i < n; ++i) {
+        quantized[i] = (int8_t) std::lrint(values[i] / scale);
+    }
+    return scale;
+}
+
+#pragma mark - Kernels
+
+/** @return the dot product of n floats and n half precision values; n must be a multiple of 8. */
+static inline float dotHalf(const float* a, const uint16_t* b, int n) {
+#if defined(LEIA_AU_COMPACT_NEON)
+    float32x4_t s0 = vdupq_n_f32(0.0f), s1 = vdupq_n_f32(0.0f);
+    for (int i = 0; i < n; i += 8) {
+        const float32x4_t b0 = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(b + i)));
+        const float32x4_t b1 = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(b + i + 4)));
+        s0 = vmlaq_f32(s0, vld1q_f32(a + i), b0);
+        s1 = vmlaq_f32(s1, vld1q_f32(a + i + 4), b1);
+    }
+    const float32x4_t s = vaddq_f32(s0, s1);
+    const float32x2_t pair = vadd_f32(vget_low_f32(s), vget_high_f32(s));
+    return vget_lane_f32(vpadd_f32(pair, pair), 0);
+#elif defined(LEIA_AU_COMPACT_F16C)
+    __m256 s = _mm256_setzero_ps();
+    for (int i = 0; i < n; i += 8) {
+        const __m256 bf = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (b + i)));
+        s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_loadu_ps(a + i), bf));
+    }
+    __m128 q = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    q = _mm_add_ps(q, _mm_movehl_ps(q, q));
+    q = _mm_add_ss(q, _mm_shuffle_ps(q, q, 1));
+    return _mm_cvtss_f32(q);
+#else
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    for (int i = 0; i < n; i += 4) {
+        s0 += a[i] * halfToFloat(b[i]);
+        s1 += a[i + 1] * halfToFloat(b[i + 1]);
+        s2 += a[i + 2] * halfToFloat(b[i + 2]);
+        s3 += a[i + 3] * halfToFloat(b[i + 3]);
+    }
+    return (s0 + s1) + (s2 + s3);
+#endif
+}
+
+/** @return the dot product of n floats and n int8 values with a common scale; n must be a multiple of 8. */
+static inline float dotInt8(const float* a, const int8_t* b, float scale, int n) {
+#if defined(LEIA_AU_COMPACT_NEON)
+    float32x4_t s0 = vdupq_n_f32(0.0f), s1 = vdupq_n_f32(0.0f);
+    for (int i = 0; i < n; i += 8) {
+        const int16x8_t wide = vmovl_s8(vld1_s8(b + i));
+        const float32x4_t b0 = vcvtq_f32_s32(vmovl_s16(vget_low_s16(wide)));
+        const float32x4_t b1 = vcvtq_f32_s32(vmovl_s16(vget_high_s16(wide)));
+        s0 = vmlaq_f32(s0, vld1q_f32(a + i), b0);
+        s1 = vmlaq_f32(s1, vld1q_f32(a + i + 4), b1);
+    }
+    const float32x4_t s = vaddq_f32(s0, s1);
+    const float32x2_t pair = vadd_f32(vget_low_f32(s), vget_high_f32(s));
+    return vget_lane_f32(vpadd_f32(pair, pair), 0) * scale;
+#elif defined(__AVX2__)
+    __m256 s = _mm256_setzero_ps();
+    for (int i = 0; i < n; i += 8) {
+        const __m256 bf = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*) (b + i))));
+        s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_loadu_ps(a + i), bf));
+    }
+    __m128 q = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    q = _mm_add_ps(q, _mm_movehl_ps(q, q));
+    q = _mm_add_ss(q, _mm_shuffle_ps(q, q, 1));
+    return _mm_cvtss_f32(q) * scale;
+#else
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    for (int i = 0; i < n; i += 4) {
+        s0 += a[i] * (float) b[i];
+        s1 += a[i + 1] * (float) b[i + 1];
+        s2 += a[i + 2] * (float) b[i + 2];
+        s3 += a[i + 3] * (float) b[i + 3];
+    }
+    return ((s0 + s1) + (s2 + s3)) * scale;
+#endif
+}
+
+#endif /* LeiaAUCompactFloat_h */
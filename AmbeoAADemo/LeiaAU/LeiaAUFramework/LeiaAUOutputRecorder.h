@@ -0,0 +1,345 @@
+/**
+ * Copyright (c) Sennheiser Electronic GmbH & Co. KG, 2018. All Rights Reserved.
+ *
+ * Distributed as part of the AMBEO Augmented Audio Developers Program.
+ * You may only use this code under the terms stated in LICENSE.md, which was distributed alongside this code.
+ */
+
+#ifndef LeiaAUOutputRecorder_h
+#define LeiaAUOutputRecorder_h
+
+#include <AudioToolbox/ExtendedAudioFile.h>
+
+#include "LeiaAURingBuffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const double RECORDING_RING_SECONDS = 2.0;     // audio buffered per channel until the writer catches up
+static const UInt32 RECORDING_CHUNK_FRAMES = 16384;   // frames per file write
+static const int RECORDING_WRITE_INTERVAL_MS = 50;    // how often the writer thread drains the rings
+
+typedef enum {
+    RECORDING_FILE_CAF = 0,
+    RECORDING_FILE_WAV
+} RecordingFileType;
+
+/**
+ * Life cycle of a source's input track:
+ * FREE -> RECORDING (render thread, when a source appears on an input bus),
+ * RECORDING -> CLOSING (render thread, when the source leaves the input busses),
+ * CLOSING -> FREE (writer thread, once it has written the rest and closed the file).
+ */
+typedef enum {
+    TRACK_FREE = 0,
+    TRACK_RECORDING,
+    TRACK_CLOSING
+} RecordingTrackState;
+
+/**
+ * One recorded file: the binaural output, or the input of one source. Its samples pass through
+ * one ring per channel; the writer thread creates the file once the first samples arrive.
+ */
+struct RecordingTrack {
+    int channels = 0;                        // 0 if the track is not recorded
+    SampleRingBuffer rings[2];
+    std::atomic<int> state{TRACK_FREE};
+    int sourceId = 0;                        // set by the render thread while FREE
+    int64_t startFrame = 0;                  // the output frame the track starts at; set with sourceId
+    std::string path;                        // writer thread only, for source tracks
+    ExtAudioFileRef file = nullptr;          // writer thread only
+    bool failed = false;                     // writer thread only: the file could not be created
+    std::atomic<uint64_t> droppedFrames{0};
+};
+
+/**
+ * OutputRecorder records LeiaAU's output, and optionally the input of each input bus source, to audio files.
+ *
+ * The render thread copies each block into preallocated lock-free rings, one per channel, and a
+ * background thread writes them to disk in large chunks with ExtAudioFile. Files are 32-bit
+ * float, in CAF or WAV. If the writer falls behind by more than the rings hold, blocks are
+ * dropped and counted instead of blocking the render thread. While recording is inactive,
+ * capturing a block costs one atomic load.
+ *
+ * Inputs are recorded per source, not per bus: removing a source moves the sources of later
+ * busses down one bus, and each source should stay in one file. A source's file starts when it
+ * appears on the input busses and ends when it leaves them, so it is named after the source and
+ * the output frame it starts at. Source tracks come from a pool twice the number of busses, so
+ * that a track can be claimed while the writer still closes the file of the source before it.
+ *
+ * init(), start() and stop() allocate and are called by the main thread; the capture functions
+ * are real-time safe.
+ */
+struct OutputRecorder {
+
+    std::vector<RecordingTrack> tracks;      // the output, followed by the pool of source tracks
+    std::atomic<bool> active{false};
+    std::atomic<int> producers{0};           // captures currently between the active check and the ring write
+    bool sourceInputs = false;
+    int64_t outputFrames = 0;                // render thread: output frames captured so far
+    std::string basePath;
+    double sampleRate = 0.0;
+    RecordingFileType fileType = RECORDING_FILE_CAF;
+    std::vector<float> chunk;                // interleaved frames (writer thread)
+    std::thread writerThread;
+    std::atomic<bool> writerRunning{false};
+
+    /** @param numBusses  The number of input busses whose input can be recorded. */
+    void init(int numBusses) {
+        tracks = std::vector<RecordingTrack>((size_t) 2 * numBusses + 1);
+        chunk.assign((size_t) 2 * RECORDING_CHUNK_FRAMES, 0.0f);
+    }
+
+    ~OutputRecorder() {
+        stop();
+    }
+
+    /**
+     * Starts recording the output to `path`. If `busInputs` is set, the input of each input bus
+     * source is recorded to `path`, with "-source<id>-<frame>" inserted before the extension,
+     * where frame is the frame of the output at which the source's file starts.
+     *
+     * @return false if recording is already active.
+     */
+    bool start(const char* path, bool busInputs, double inSampleRate, RecordingFileType inFileType) {
+        if (active.load()) { return false; }
+        sampleRate = inSampleRate;
+        fileType = inFileType;
+        sourceInputs = busInputs;
+        outputFrames = 0;
+        basePath = path;
+        const size_t ringFrames = (size_t) (RECORDING_RING_SECONDS * sampleRate);
+        for (size_t t = 0; t < tracks.size(); ++t) {
+            RecordingTrack& track = tracks[t];
+            track.channels = t == 0 ? 2 : (busInputs ? 1 : 0);
+            for (int c = 0; c < track.channels; ++c) {
+                track.rings[c].init(ringFrames, 0);
+            }
+            track.state.store(t == 0 ? TRACK_RECORDING : TRACK_FREE);
+            track.path = t == 0 ? basePath : std::string();
+            track.file = nullptr;
+            track.failed = false;
+            track.droppedFrames.store(0);
+        }
+        writerRunning.store(true);
+        writerThread = std::thread([this] { writeLoop(); });
+        active.store(true, std::memory_order_release);
+        return true;
+    }
+
+    /** Stops recording, writes all buffered audio and closes the files. */
+    void stop() {
+        if (!active.exchange(false)) { return; }
+        while (producers.load() != 0) { std::this_thread::yield(); }
+        writerRunning.store(false);
+        writerThread.join();
+    }
+
+    bool isActive() const {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    /** @return the number of frames dropped by all tracks of the current or last recording. */
+    uint64_t droppedFrames() const {
+        uint64_t frames = 0;
+        for (const RecordingTrack& track : tracks) {
+            frames += track.droppedFrames.load(std::memory_order_relaxed);
+        }
+        return frames;
+    }
+
+    /**
+     * Render thread: records one block of the binaural output. Call it after captureBusInputs()
+     * for the same block.
+     */
+    void captureOutput(const float* const* channels, int n) {
+        if (!active.load(std::memory_order_acquire)) { return; }
+        producers.fetch_add(1);
+        if (active.load()) {
+            capture(tracks[0], channels, n);
+            outputFrames += n;
+        }
+        producers.fetch_sub(1);
+    }
+
+    /**
+     * Render thread: records one block of the input busses, where bus i carries the source
+     * `sourceIds[i]`. Sources that are no longer on any bus end their files.
+     */
+    void captureBusInputs(const int* sourceIds, const float* const* inputs, int numInputs, int n) {
+        if (!active.load(std::memory_order_acquire) || !sourceInputs) { return; }
+        producers.fetch_add(1);
+        if (active.load()) {
+            for (size_t t = 1; t < tracks.size(); ++t) {
+                RecordingTrack& track = tracks[t];
+                if (track.state.load(std::memory_order_acquire) != TRACK_RECORDING) { continue; }
+                if (std::find(sourceIds, sourceIds + numInputs, track.sourceId) == sourceIds + numInputs) {
+                    track.state.store(TRACK_CLOSING, std::memory_order_release);
+                }
+            }
+            for (int i = 0; i < numInputs; ++i) {
+                RecordingTrack* track = sourceTrack(sourceIds[i]);
+                if (track == nullptr) {
+                    // Every track is still being closed; count the block as dropped on the output track.
+                    tracks[0].droppedFrames.fetch_add((uint64_t) n, std::memory_order_relaxed);
+                    continue;
+                }
+                capture(*track, &inputs[i], n);
+            }
+        }
+        producers.fetch_sub(1);
+    }
+
+private:
+
+    /** @return the track recording `sourceId`, or a newly claimed free one; nullptr if none is free. */
+    RecordingTrack* sourceTrack(int sourceId) {
+        RecordingTrack* free = nullptr;
+        for (size_t t = 1; t < tracks.size(); ++t) {
+            RecordingTrack& track = tracks[t];
+            const int state = track.state.load(std::memory_order_acquire);
+            if (state == TRACK_RECORDING && track.sourceId == sourceId) { return &track; }
+            if (state == TRACK_FREE && free == nullptr) { free = &track; }
+        }
+        if (free != nullptr) {
+            free->sourceId = sourceId;
+            free->startFrame = outputFrames;
+            free->state.store(TRACK_RECORDING, std::memory_order_release);
+        }
+        return free;
+    }
+
+    static void capture(RecordingTrack& track, const float* const* channels, int n) {
+        if (track.channels > 0 && track.rings[0].writable() < (size_t) n) {
+            track.droppedFrames.fetch_add((uint64_t) n, std::memory_order_relaxed);
+        } else {
+            // The last channel is written last, so the writer never reads past the other channels.
+            for (int c = 0; c < track.channels; ++c) {
+                track.rings[c].write(channels[c], (size_t) n);
+            }
+        }
+    }
+
+    std::string sourcePath(const RecordingTrack& track) const {
+        const size_t slash = basePath.find_last_of('/');
+        size_t dot = basePath.find_last_of('.');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) { dot = basePath.size(); }
+        return basePath.substr(0, dot) + "-source" + std::to_string(track.sourceId) + "-"
+             + std::to_string((long long) track.startFrame) + basePath.substr(dot);
+    }
+
+    void writeLoop() {
+        while (writerRunning.load()) {
+            for (RecordingTrack& track : tracks) {
+                const int state = track.state.load(std::memory_order_acquire);
+                if (state == TRACK_FREE) { continue; }
+                const size_t minimum = state == TRACK_CLOSING ? 1 : RECORDING_CHUNK_FRAMES;
+                while (readable(track) >= minimum) {
+                    write(track, (UInt32) std::min(readable(track), (size_t) RECORDING_CHUNK_FRAMES));
+                }
+                if (state == TRACK_CLOSING) {
+                    // The render thread no longer writes to the track, so all of it has been written.
+                    closeFile(track);
+                    track.state.store(TRACK_FREE, std::memory_order_release);
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(RECORDING_WRITE_INTERVAL_MS));
+        }
+        // Recording has stopped; write the rest, and complete the files.
+        for (RecordingTrack& track : tracks) {
+            if (track.state.load(std::memory_order_acquire) == TRACK_FREE) { continue; }
+            while (readable(track) > 0) {
+                write(track, (UInt32) std::min(readable(track), (size_t) RECORDING_CHUNK_FRAMES));
+            }
+            closeFile(track);
+        }
+    }
+
+    static void closeFile(RecordingTrack& track) {
+        if (track.file != nullptr) {
+            ExtAudioFileDispose(track.file);
+            track.file = nullptr;
+        }
+        track.failed = false;
+    }
+
+    static size_t readable(const RecordingTrack& track) {
+        return track.channels > 0 ? track.rings[track.channels - 1].readable() : 0;
+    }
+
+    /** Writes the next `frames` frames of a track to its file, interleaved. */
+    void write(RecordingTrack& track, UInt32 frames) {
+        for (int c = 0; c < track.channels; ++c) {
+            // The ring has no guard region, so read it in up to two contiguous parts.
+            SampleRingBuffer& ring = track.rings[c];
+            const size_t start = ring.readIndex.load(std::memory_order_relaxed) & (ring.capacity - 1);
+            const size_t first = std::min((size_t) frames, ring.capacity - start);
+            const float* data = ring.readPointer();
+            for (size_t i = 0; i < first; ++i) {
+                chunk[i * track.channels + c] = data[i];
+            }
+            for (size_t i = first; i < frames; ++i) {
+                chunk[i * track.channels + c] = ring.data[i - first];
+            }
+            ring.consume(frames);
+        }
+        if (track.file == nullptr && !track.failed) {
+            if (&track != &tracks[0]) { track.path = sourcePath(track); }
+            track.failed = !createFile(track);
+        }
+        if (track.failed) {
+            track.droppedFrames.fetch_add(frames, std::memory_order_relaxed);
+            return;
+        }
+
+        AudioBufferList bufferList;
+        bufferList.mNumberBuffers = 1;
+        bufferList.mBuffers[0].mNumberChannels = (UInt32) track.channels;
+        bufferList.mBuffers[0].mDataByteSize = frames * track.channels * sizeof(float);
+        bufferList.mBuffers[0].mData = chunk.data();
+        const OSStatus err = ExtAudioFileWrite(track.file, frames, &bufferList);
+        if (err != noErr) {
+            printf("LeiaAU - ERROR: failed to write recording %s (%d).\n", track.path.c_str(), (int) err);
+            track.droppedFrames.fetch_add(frames, std::memory_order_relaxed);
+        }
+    }
+
+    bool createFile(RecordingTrack& track) {
+        AudioStreamBasicDescription format = {};
+        format.mSampleRate = sampleRate;
+        format.mFormatID = kAudioFormatLinearPCM;
+        format.mFormatFlags = kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked | kAudioFormatFlagsNativeEndian;
+        format.mChannelsPerFrame = (UInt32) track.channels;
+        format.mBitsPerChannel = 32;
+        format.mFramesPerPacket = 1;
+        format.mBytesPerFrame = (UInt32) track.channels * sizeof(float);
+        format.mBytesPerPacket = format.mBytesPerFrame;
+
+        const char* path = track.path.c_str();
+        CFURLRef url = CFURLCreateFromFileSystemRepresentation(nullptr, (const UInt8*) path, (CFIndex) strlen(path), false);
+        OSStatus err = ExtAudioFileCreateWithURL(url, fileType == RECORDING_FILE_WAV ? kAudioFileWAVEType : kAudioFileCAFType,
+                                                 &format, nullptr, kAudioFileFlags_EraseFile, &track.file);
+        CFRelease(url);
+        if (err == noErr) {
+            // The client format equals the file format; setting it lets ExtAudioFile write without converting.
+            err = ExtAudioFileSetProperty(track.file, kExtAudioFileProperty_ClientDataFormat, sizeof(format), &format);
+        }
+        if (err != noErr) {
+            printf("LeiaAU - ERROR: could not create recording %s (%d).\n", path, (int) err);
+            if (track.file != nullptr) {
+                ExtAudioFileDispose(track.file);
+                track.file = nullptr;
+            }
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif /* LeiaAUOutputRecorder_h */
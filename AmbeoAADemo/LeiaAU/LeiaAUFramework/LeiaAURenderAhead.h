@@ -0,0 +1,340 @@
+/**
+ * Copyright (c) Sennheiser Electronic GmbH & Co. KG, 2018. All Rights Reserved.
+ *
+ * Distributed as part of the AMBEO Augmented Audio Developers Program.
+ * You may only use this code under the terms stated in LICENSE.md, which was distributed alongside this code.
+ */
+
+#ifndef LeiaAURenderAhead_h
+#define LeiaAURenderAhead_h
+
+#include "LeiaAUCallRecorder.h"
+#include "LeiaAURingBuffer.h"
+#include "LeiaAUSourceActivity.h"
+#include "LeiaAUSourceStreamer.h"
+#include "SennheiserAmbeoLeia.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
+#include <pthread.h>
+#endif
+
+static const int MIN_RENDER_AHEAD_BLOCKS = 2;   // the worker needs a block of slack for the bus input of each callback
+static const int MAX_RENDER_AHEAD_BLOCKS = 8;
+static const int RENDER_AHEAD_POLLS_PER_BLOCK = 4;   // how often per block the worker tops up the FIFO
+static const int RENDER_AHEAD_INPUT_BLOCKS = MAX_RENDER_AHEAD_BLOCKS + 2;   // queued blocks of bus input
+
+/**
+ * One engine block of the input of the bus sources, queued for the worker.
+ */
+struct BusInputBlock {
+    int count = 0;
+    int* sourceIds = nullptr;
+    int* activitySlots = nullptr;
+    float* samples = nullptr;                // source i at samples + i * blockFrames
+};
+
+/**
+ * RenderAheadPipeline moves the Leia engine off the audio callback. A worker thread renders
+ * the sources a configurable number of blocks ahead into a lock-free stereo FIFO, and the audio
+ * callback only copies the output from there. A load spike in the engine then costs a dropout
+ * only once it outlasts the blocks rendered ahead, in exchange for that latency.
+ *
+ * Streaming sources are rendered whenever the FIFO runs low. The audio of input bus sources only
+ * arrives with each callback, so the callback collects it into engine blocks, and queues each full
+ * block to the worker, which renders it `blocks` blocks later. While bus sources exist, the worker
+ * renders only those queued blocks, so input and output stay in step. This needs at least 2 blocks
+ * ahead: with 1, the worker would have to render each block before the next callback, so fewer are
+ * not accepted. If the worker falls so far behind that the queue is full, bus input is dropped and
+ * counted as an underrun.
+ *
+ * While enabled, the worker rather than the audio callback makes every per-block engine call:
+ * it feeds bus and streaming sources to the engine, calls SourceActivityTracker::process(), counts
+ * blocks for the CallRecorder with recordAudio() and recordProcess(), and calls
+ * SourceStreamer::advance(), so streaming sources move from REMOVING to RETIRED on the worker.
+ *
+ * Listener pose: the engine renders binaural output, which cannot be rotated afterwards; that
+ * would need the sound field before binauralization, which the engine does not expose. The
+ * worker therefore renders each block as late as the FIFO allows, at most `blocks` blocks
+ * before it is heard, so every block uses the newest listener orientation at that time.
+ * Head rotation reaches the ear that much later than in the synchronous mode.
+ *
+ * init(), setBlocks() and start() allocate and must not be called while rendering.
+ * queueBusInputs() and read() are real-time safe; they are the only functions the audio
+ * callback calls.
+ */
+struct RenderAheadPipeline {
+
+    LeiaInstance* leia = nullptr;
+    SourceStreamer* streamer = nullptr;
+    SourceActivityTracker* activity = nullptr;
+    CallRecorder* recorder = nullptr;
+    int blockFrames = 0;
+    double sampleRate = 0.0;
+    int blocks = 0;                          // 0 if disabled
+    SampleRingBuffer output[2];              // binaural left and right
+    std::vector<float> block;                // 2 channels of blockFrames (worker thread)
+    std::atomic<bool> running{false};
+    std::thread worker;
+    std::atomic<uint32_t> underruns{0};      // callbacks the FIFO could not fill, and bus input blocks dropped
+
+    int maxBusSources = 0;
+    BusInputBlock inputQueue[RENDER_AHEAD_INPUT_BLOCKS];
+    std::vector<int> inputIds;               // the source IDs and activity slots of all queue entries
+    std::vector<float> inputSamples;         // the samples of all queue entries
+    std::vector<float> remapSamples;         // the block being collected, while its sources change (audio callback)
+    std::atomic<size_t> inputWrite{0};       // the entry the audio callback collects into
+    std::atomic<size_t> inputRead{0};        // the next entry the worker renders
+    int collectedFrames = 0;                 // frames of the entry being collected (audio callback)
+    std::atomic<bool> busInputs{false};      // whether the last callback had bus sources
+
+    /** @param inMaxBusSources  The largest number of bus sources queueBusInputs() is called with. */
+    void init(LeiaInstance* inLeia, SourceStreamer* inStreamer, SourceActivityTracker* inActivity,
+              CallRecorder* inRecorder, int inBlockFrames, double inSampleRate, int inMaxBusSources) {
+        leia = inLeia;
+        streamer = inStreamer;
+        activity = inActivity;
+        recorder = inRecorder;
+        blockFrames = inBlockFrames;
+        sampleRate = inSampleRate;
+        block.assign((size_t) 2 * blockFrames, 0.0f);
+
+        maxBusSources = inMaxBusSources;
+        const size_t entrySamples = (size_t) maxBusSources * blockFrames;
+        inputIds.assign((size_t) 2 * maxBusSources * RENDER_AHEAD_INPUT_BLOCKS, 0);
+        inputSamples.assign(entrySamples * RENDER_AHEAD_INPUT_BLOCKS, 0.0f);
+        remapSamples.assign(entrySamples, 0.0f);
+        for (int e = 0; e < RENDER_AHEAD_INPUT_BLOCKS; ++e) {
+            inputQueue[e].sourceIds = inputIds.data() + (size_t) 2 * e * maxBusSources;
+            inputQueue[e].activitySlots = inputQueue[e].sourceIds + maxBusSources;
+            inputQueue[e].samples = inputSamples.data() + entrySamples * e;
+        }
+    }
+
+    ~RenderAheadPipeline() {
+        stop();
+    }
+
+    /** @param inBlocks  Blocks to render ahead, from MIN_RENDER_AHEAD_BLOCKS, or 0 to render in the audio callback. */
+    void setBlocks(int inBlocks) {
+        blocks = inBlocks <= 0 ? 0 : std::max(MIN_RENDER_AHEAD_BLOCKS, std::min(inBlocks, MAX_RENDER_AHEAD_BLOCKS));
+    }
+
+    bool enabled() const {
+        return blocks > 0;
+    }
+
+    /**
+     * Allocates the FIFO, fills it with `blocks` blocks of silence, and starts the worker.
+     *
+     * The engine is not called to fill the FIFO: it would read the last buffer of each bus source,
+     * which may be memory of the previous render resources or of the host. The worker only renders
+     * bus sources with their queued input, and the first callback queues it before reading.
+     *
+     * @param maxReadFrames  The largest number of frames read() is called with.
+     */
+    void start(int maxReadFrames) {
+        if (!enabled() || running.load()) { return; }
+        const size_t capacity = (size_t) (blocks + 1) * blockFrames + maxReadFrames;
+        for (SampleRingBuffer& channel : output) {
+            channel.init(capacity, (size_t) maxReadFrames);
+        }
+        underruns.store(0);
+        inputWrite.store(0);
+        inputRead.store(0);
+        collectedFrames = 0;
+        busInputs.store(false);
+        std::fill(block.begin(), block.end(), 0.0f);
+        while (output[1].readable() < targetFrames()) {
+            output[0].write(block.data(), (size_t) blockFrames);
+            output[1].write(block.data() + blockFrames, (size_t) blockFrames);
+        }
+        running.store(true);
+        worker = std::thread([this] { workerLoop(); });
+    }
+
+    void stop() {
+        if (running.exchange(false)) {
+            worker.join();
+        }
+    }
+
+    /**
+     * Audio callback: queues n frames of the input of `count` bus sources, at the engine's sample
+     * rate, for the worker to render. Call this every callback before read(), with a count of 0
+     * once there are no bus sources.
+     */
+    void queueBusInputs(int count, const int* sourceIds, const int* activitySlots, const float* const* inputs, int n) {
+        busInputs.store(count > 0, std::memory_order_relaxed);
+        if (count == 0) {
+            // Let the worker render the rest of the last bus input, padded with silence.
+            if (collectedFrames > 0 && !inputQueueFull()) {
+                BusInputBlock& entry = inputQueue[inputWrite.load(std::memory_order_relaxed) % RENDER_AHEAD_INPUT_BLOCKS];
+                for (int i = 0; i < entry.count; ++i) {
+                    memset(entry.samples + (size_t) i * blockFrames + collectedFrames, 0, (blockFrames - collectedFrames) * sizeof(float));
+                }
+                commitBusInputs();
+            }
+            return;
+        }
+
+        for (int offset = 0; offset < n; ) {
+            if (inputQueueFull()) {
+                // The worker has fallen behind by the whole queue; drop this input rather than wait.
+                underruns.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            BusInputBlock& entry = inputQueue[inputWrite.load(std::memory_order_relaxed) % RENDER_AHEAD_INPUT_BLOCKS];
+            collectSources(entry, count, sourceIds, activitySlots);
+            const int frames = std::min(n - offset, blockFrames - collectedFrames);
+            for (int i = 0; i < count; ++i) {
+                memcpy(entry.samples + (size_t) i * blockFrames + collectedFrames, inputs[i] + offset, frames * sizeof(float));
+            }
+            collectedFrames += frames;
+            offset += frames;
+            if (collectedFrames == blockFrames) {
+                commitBusInputs();
+            }
+        }
+    }
+
+    /** Audio callback: copies the next n frames; frames not rendered in time are silent. */
+    void read(float* const* out, int n) {
+        const int available = (int) std::min((size_t) n, output[1].readable()); // the right channel is written last
+        if (available < n) {
+            underruns.fetch_add(1, std::memory_order_relaxed);
+        }
+        for (int c = 0; c < 2; ++c) {
+            memcpy(out[c], output[c].readPointer(), available * sizeof(float));
+            memset(out[c] + available, 0, (n - available) * sizeof(float));
+            output[c].consume((size_t) available);
+        }
+    }
+
+    /** The delay between rendering a block and hearing it, in seconds. */
+    double latencyInSeconds() const {
+        return enabled() ? targetFrames() / sampleRate : 0.0;
+    }
+
+private:
+
+    size_t targetFrames() const {
+        return (size_t) blocks * blockFrames;
+    }
+
+    bool inputQueueFull() const {
+        return inputWrite.load(std::memory_order_relaxed) - inputRead.load(std::memory_order_acquire) == RENDER_AHEAD_INPUT_BLOCKS;
+    }
+
+    /** Audio callback: publishes the entry being collected to the worker. */
+    void commitBusInputs() {
+        collectedFrames = 0;
+        inputWrite.store(inputWrite.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * Audio callback: makes the entry being collected hold the given sources. Sources added within
+     * the block start with silence; the input of sources removed within the block is dropped.
+     */
+    void collectSources(BusInputBlock& entry, int count, const int* sourceIds, const int* activitySlots) {
+        if (collectedFrames == 0) {
+            entry.count = count;
+            memcpy(entry.sourceIds, sourceIds, count * sizeof(int));
+            memcpy(entry.activitySlots, activitySlots, count * sizeof(int));
+            return;
+        }
+        if (entry.count == count && memcmp(entry.sourceIds, sourceIds, count * sizeof(int)) == 0) { return; }
+
+        for (int i = 0; i < count; ++i) {
+            float* remapped = remapSamples.data() + (size_t) i * blockFrames;
+            const int* previous = std::find(entry.sourceIds, entry.sourceIds + entry.count, sourceIds[i]);
+            if (previous != entry.sourceIds + entry.count) {
+                memcpy(remapped, entry.samples + (size_t) (previous - entry.sourceIds) * blockFrames, collectedFrames * sizeof(float));
+            } else {
+                memset(remapped, 0, collectedFrames * sizeof(float));
+            }
+        }
+        for (int i = 0; i < count; ++i) {
+            memcpy(entry.samples + (size_t) i * blockFrames, remapSamples.data() + (size_t) i * blockFrames, collectedFrames * sizeof(float));
+        }
+        entry.count = count;
+        memcpy(entry.sourceIds, sourceIds, count * sizeof(int));
+        memcpy(entry.activitySlots, activitySlots, count * sizeof(int));
+    }
+
+    void workerLoop() {
+        setRealtimePriority();
+        const auto interval = std::chrono::duration<double>(blockFrames / sampleRate / RENDER_AHEAD_POLLS_PER_BLOCK);
+        while (running.load()) {
+            while (running.load() && renderNextBlock()) {}
+            std::this_thread::sleep_for(interval);
+        }
+    }
+
+    /** Worker: renders the next block, if one is due. @return false if none was. */
+    bool renderNextBlock() {
+        if (inputRead.load(std::memory_order_relaxed) != inputWrite.load(std::memory_order_acquire)) {
+            // Bus input is rendered as soon as the FIFO has room; its timing is set by the callback.
+            if (output[1].writable() < (size_t) blockFrames) { return false; }
+            const size_t read = inputRead.load(std::memory_order_relaxed);
+            renderBlock(&inputQueue[read % RENDER_AHEAD_INPUT_BLOCKS]);
+            inputRead.store(read + 1, std::memory_order_release);
+            return true;
+        }
+        // Without bus input, render no earlier than needed, so each block uses the newest listener pose.
+        if (busInputs.load(std::memory_order_relaxed) || output[1].readable() >= targetFrames()) { return false; }
+        renderBlock(nullptr);
+        return true;
+    }
+
+    /** Renders one block of the bus input `entry`, if any, and of the streaming sources into the FIFO. */
+    void renderBlock(const BusInputBlock* entry) {
+        float* channels[2] = { block.data(), block.data() + blockFrames };
+        for (int i = 0; entry != nullptr && i < entry->count; ++i) {
+            const int sourceId = entry->sourceIds[i];
+            const int slot = entry->activitySlots[i];
+            float* samples = entry->samples + (size_t) i * blockFrames;
+            // The source may have been removed, and its slot reused, since this block was queued.
+            if (slot >= 0 && !activity->tracks(slot, sourceId)) { continue; }
+            if (!activity->process(leia, slot, samples, blockFrames)) { continue; }
+            recorder->recordAudio(sourceId, samples, blockFrames);
+            leia_source_audio_update(leia, sourceId, samples, blockFrames);
+        }
+        streamer->feedEngine(leia, blockFrames, activity, recorder);
+        recorder->recordProcess(blockFrames);
+        leia_process_source_audio(leia, channels, blockFrames);
+        streamer->advance();
+        output[0].write(channels[0], (size_t) blockFrames);
+        output[1].write(channels[1], (size_t) blockFrames);
+    }
+
+    /** Lets the worker compete with the audio threads: it computes one block per block period. */
+    void setRealtimePriority() {
+#ifdef __APPLE__
+        mach_timebase_info_data_t timebase;
+        mach_timebase_info(&timebase);
+        const double ticksPerSecond = 1e9 * timebase.denom / timebase.numer;
+        const uint32_t period = (uint32_t) (ticksPerSecond * blockFrames / sampleRate);
+        thread_time_constraint_policy_data_t policy;
+        policy.period = period;
+        policy.computation = period / 2;
+        policy.constraint = period;
+        policy.preemptible = true;
+        if (thread_policy_set(pthread_mach_thread_np(pthread_self()), THREAD_TIME_CONSTRAINT_POLICY,
+                              (thread_policy_t) &policy, THREAD_TIME_CONSTRAINT_POLICY_COUNT) != KERN_SUCCESS) {
+            printf("LeiaAU - WARNING: the render ahead thread runs without real-time priority.\n");
+        }
+#endif
+    }
+};
+
+#endif /* LeiaAURenderAhead_h */
@@ -0,0 +1,322 @@
+/**
+ * Copyright (c) Sennheiser Electronic GmbH & Co. KG, 2018. All Rights Reserved.
+ *
+ * Distributed as part of the AMBEO Augmented Audio Developers Program.
+ * You may only use this code under the terms stated in LICENSE.md, which was distributed alongside this code.
+ */
+
+#ifndef LeiaAUResampler_h
+#define LeiaAUResampler_h
+
+#include "LeiaAUCompactFloat.h"
+#include "LeiaAUTableFile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#ifdef __APPLE__
+#include <Accelerate/Accelerate.h>
+#endif
+
+/**
+ * Table file section tag of a polyphase filter bank. param0 is the input rate, param1 the output rate.
+ * A TABLE_FORMAT_INT8 bank holds one float scale per phase, followed by the quantized coefficients.
+ */
+static const uint32_t TABLE_POLYPHASE_BANK = 1;
+
+/** Number of taps per phase of the filter bank, for a ratio where no anti-aliasing is needed. */
+static const int RESAMPLER_BASE_TAPS = 32;
+
+/**
+ * @return format if the resampler converts it with vector kernels on this target, and float32
+ * otherwise: the scalar kernels of the compact formats are several times slower than float32.
+ */
+static inline TableSectionFormat vectorizedCoefficientFormat(TableSectionFormat format) {
+#if !defined(LEIA_AU_COMPACT_HALF_SIMD)
+    if (format == TABLE_FORMAT_FLOAT16) { return TABLE_FORMAT_FLOAT32; }
+#endif
+#if !defined(LEIA_AU_COMPACT_INT8_SIMD)
+    if (format == TABLE_FORMAT_INT8) { return TABLE_FORMAT_FLOAT32; }
+#endif
+    return format;
+}
+
+/** Host sample rates the filter banks are baked and measured for; LeiaAU designs others at initialization. */
+static const int HOST_SAMPLE_RATES[] = {8000, 16000, 22050, 24000, 32000, 44100, 48000, 88200, 96000, 176400, 192000};
+
+/**
+ * A polyphase decomposition of a Kaiser windowed sinc lowpass, for the rational
+ * rate ratio L/M (outputRate / inputRate, in lowest terms).
+ *
+ * Phase p holds `taps` coefficients in reversed order, so that an output sample
+ * is the dot product of phase p and the last `taps` input samples.
+ *
+ * The coefficients are designed in float, and may be stored compactly as half precision
+ * or int8 (see LeiaAUCompactFloat.h); dot() converts them back on the fly.
+ */
+struct PolyphaseFilterBank {
+
+    int upFactor = 1;        // L
+    int downFactor = 1;      // M
+    int taps = 0;            // coefficients per phase
+    int format = TABLE_FORMAT_FLOAT32;
+    bool baked = false;      // whether the coefficients are mapped from a table file
+    const float* coefficients = nullptr;         // TABLE_FORMAT_FLOAT32
+    const uint16_t* halfCoefficients = nullptr;  // TABLE_FORMAT_FLOAT16
+    const float* scales = nullptr;               // TABLE_FORMAT_INT8, one per phase
+    const int8_t* int8Coefficients = nullptr;    // TABLE_FORMAT_INT8
+    std::vector<float> storage;
+    std::vector<uint8_t> compactStorage;
+
+    /** Sets up the ratio for the given rates, without computing any coefficients. */
+    void setRates(int inputRate, int outputRate) {
+        int divisor = greatestCommonDivisor(inputRate, outputRate);
+        upFactor = outputRate / divisor;
+        downFactor = inputRate / divisor;
+        // When decimating, the cutoff drops by L/M; lengthen the filter to keep the transition band.
+        taps = RESAMPLER_BASE_TAPS * ((downFactor + upFactor - 1) / upFactor);
+        format = TABLE_FORMAT_FLOAT32;
+        baked = false;
+        coefficients = nullptr;
+        halfCoefficients = nullptr;
+        scales = nullptr;
+        int8Coefficients = nullptr;
+        storage.clear();
+        compactStorage.clear();
+    }
+
+    size_t numCoefficients() const {
+        return (size_t) upFactor * taps;
+    }
+
+    /** Computes the coefficients for the given rates. Allocates; do not call on the audio thread. */
+    void design(int inputRate, int outputRate) {
+        setRates(inputRate, outputRate);
+        const int length = upFactor * taps;
+        const double cutoff = 0.5 * 0.91 / std::max(upFactor, downFactor); // in cycles per upsampled sample
+        const double beta = 8.0;
+        const double center = 0.5 * (length - 1);
+        storage.assign(numCoefficients(), 0.0f);
+        for (int n = 0; n < length; ++n) {
+            double x = n - center;
+            double sinc = x == 0.0 ? 1.0 : std::sin(2.0 * M_PI * cutoff * x) / (2.0 * M_PI * cutoff * x);
+            double r = x / center;
+            double window = besselI0(beta * std::sqrt(std::max(0.0, 1.0 - r * r))) / besselI0(beta);
+            // Gain L compensates for the zeros inserted when upsampling.
+            double h = upFactor * 2.0 * cutoff * sinc * window;
+            int phase = n % upFactor;
+            int tap = n / upFactor;
+            storage[(size_t) phase * taps + (taps - 1 - tap)] = (float) h;
+        }
+        coefficients = storage.data();
+    }
+
+    /**
+     * Converts designed coefficients to the given format, and releases the float coefficients.
+     * Allocates; do not call on the audio thread.
+     */
+    void compact(int inFormat) {
+        if (inFormat == TABLE_FORMAT_FLOAT32 || storage.empty()) { return; }
+        compactStorage.assign(payloadSize(inFormat), 0);
+        if (inFormat == TABLE_FORMAT_FLOAT16) {
+            uint16_t* half = (uint16_t*) compactStorage.data();
+            for (size_t i = 0; i < numCoefficients(); ++i) {
+                half[i] = floatToHalf(storage[i]);
+            }
+        } else {
+            float* phaseScales = (float*) compactStorage.data();
+            int8_t* quantized = (int8_t*) (phaseScales + upFactor);
+            for (int p = 0; p < upFactor; ++p) {
+                phaseScales[p] = quantizeInt8(storage.data() + (size_t) p * taps, quantized + (size_t) p * taps, taps);
+            }
+        }
+        std::vector<float>().swap(storage);
+        use(compactStorage.data(), inFormat);
+    }
+
+    /** @return the byte size of the coefficients in the given format, as stored in a table file. */
+    size_t payloadSize(int inFormat) const {
+        switch (inFormat) {
+            case TABLE_FORMAT_FLOAT16: return numCoefficients() * sizeof(uint16_t);
+            case TABLE_FORMAT_INT8: return upFactor * sizeof(float) + numCoefficients() * sizeof(int8_t);
+            default: return numCoefficients() * sizeof(float);
+        }
+    }
+
+    /** @return the coefficients in the current format, as stored in a table file. */
+    const void* payload() const {
+        switch (format) {
+            case TABLE_FORMAT_FLOAT16: return halfCoefficients;
+            case TABLE_FORMAT_INT8: return scales;
+            default: return coefficients;
+        }
+    }
+
+    /**
+     * Uses the coefficients baked into a table file, if it holds a bank for these rates in this format.
+     *
+     * @return true if the mapped coefficients are used.
+     */
+    bool attach(const MappedTableFile& tables, int inputRate, int outputRate, int inFormat = TABLE_FORMAT_FLOAT32) {
+        setRates(inputRate, outputRate);
+        uint64_t byteSize = 0;
+        const void* data = tables.section(TABLE_POLYPHASE_BANK, (uint32_t) inputRate, (uint32_t) outputRate,
+                                          (uint32_t) inFormat, &byteSize);
+        if (data == nullptr || byteSize != payloadSize(inFormat)) { return false; }
+        use(data, inFormat);
+        baked = true;
+        return true;
+    }
+
+    /** @return the dot product of phase p and the `taps` samples starting at x. */
+    float dot(const float* x, int p) const {
+        const size_t offset = (size_t) p * taps;
+        switch (format) {
+            case TABLE_FORMAT_FLOAT16: return dotHalf(x, halfCoefficients + offset, taps);
+            case TABLE_FORMAT_INT8: return dotInt8(x, int8Coefficients + offset, scales[p], taps);
+            default: return dotFloat(x, coefficients + offset, taps);
+        }
+    }
+
+    /** Group delay of the filter, in input samples. */
+    double delayInInputSamples() const {
+        return 0.5 * (upFactor * taps - 1) / upFactor;
+    }
+
+private:
+
+    void use(const void* data, int inFormat) {
+        format = inFormat;
+        coefficients = inFormat == TABLE_FORMAT_FLOAT32 ? (const float*) data : nullptr;
+        halfCoefficients = inFormat == TABLE_FORMAT_FLOAT16 ? (const uint16_t*) data : nullptr;
+        scales = inFormat == TABLE_FORMAT_INT8 ? (const float*) data : nullptr;
+        int8Coefficients = inFormat == TABLE_FORMAT_INT8 ? (const int8_t*) (scales + upFactor) : nullptr;
+    }
+
+    static float dotFloat(const float* a, const float* b, int n) {
+#ifdef __APPLE__
+        float result;
+        vDSP_dotpr(a, 1, b, 1, &result, (vDSP_Length) n);
+        return result;
+#else
+        // Four independent accumulators so the compiler can vectorize the loop.
+        float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+        for (int i = 0; i < n; i += 4) {
+            s0 += a[i] * b[i];
+            s1 += a[i + 1] * b[i + 1];
+            s2 += a[i + 2] * b[i + 2];
+            s3 += a[i + 3] * b[i + 3];
+        }
+        return (s0 + s1) + (s2 + s3);
+#endif
+    }
+
+    static int greatestCommonDivisor(int a, int b) {
+        while (b != 0) {
+            int t = a % b;
+            a = b;
+            b = t;
+        }
+        return a;
+    }
+
+    static double besselI0(double x) {
+        double sum = 1.0;
+        double term = 1.0;
+        for (int k = 1; k < 32; ++k) {
+            term *= (0.5 * x / k) * (0.5 * x / k);
+            sum += term;
+        }
+        return sum;
+    }
+};
+
+/**
+ * A streaming multichannel resampler using a PolyphaseFilterBank.
+ *
+ * All channels share a single phase, so every channel yields the same number of output
+ * frames for a block, which lets the Leia engine process all sources with one block size.
+ * Each call consumes a whole input block and yields a variable number of output frames,
+ * which averages to inputFrames * L / M.
+ */
+struct PolyphaseResampler {
+
+    const PolyphaseFilterBank* bank = nullptr;
+    int numChannels = 0;
+    int maxInputFrames = 0;
+    int phase = 0;        // current phase, in [0, L)
+    int inputOffset = 0;  // index in the next input block of the newest sample of the next output frame
+    std::vector<float> work;  // per channel: (taps - 1) samples of history, followed by an input block
+
+    /** Allocates the state. Do not call on the audio thread. */
+    void init(const PolyphaseFilterBank* inBank, int inNumChannels, int inMaxInputFrames) {
+        bank = inBank;
+        numChannels = inNumChannels;
+        maxInputFrames = inMaxInputFrames;
+        work.assign((size_t) numChannels * stride(), 0.0f);
+        reset();
+    }
+
+    void reset() {
+        std::fill(work.begin(), work.end(), 0.0f);
+        phase = 0;
+        inputOffset = 0;
+    }
+
+    /** Clears the history of one channel, e.g. when a new source starts on it. */
+    void resetChannel(int channel) {
+        std::fill(work.begin() + (size_t) channel * stride(), work.begin() + (size_t) (channel + 1) * stride(), 0.0f);
+    }
+
+    /** @return the largest number of frames process() can yield for `inputFrames` input frames. */
+    int maxOutputFrames(int inputFrames) const {
+        return (inputFrames * bank->upFactor + bank->downFactor - 1) / bank->downFactor + 1;
+    }
+
+    /**
+     * Resamples one block of `n` <= maxInputFrames frames of the first `channels` channels.
+     * Channels not processed keep their history but must be reset before they are used again.
+     *
+     * @return the number of frames written to each output channel.
+     */
+    int process(const float* const* input, float* const* output, int channels, int n) {
+        const int taps = bank->taps;
+        const int up = bank->upFactor;
+        const int down = bank->downFactor;
+        int frames = 0;
+        for (int c = 0; c < channels; ++c) {
+            float* buffer = work.data() + (size_t) c * stride();
+            memcpy(buffer + taps - 1, input[c], n * sizeof(float));
+            int p = phase;
+            int i = inputOffset;
+            frames = 0;
+            while (i < n) {
+                output[c][frames++] = bank->dot(buffer + i, p);
+                p += down;
+                i += p / up;
+                p %= up;
+            }
+            memmove(buffer, buffer + n, (taps - 1) * sizeof(float));
+        }
+        // Advance the shared phase, even if no channel was processed.
+        frames = 0;
+        while (inputOffset < n) {
+            ++frames;
+            phase += down;
+            inputOffset += phase / up;
+            phase %= up;
+        }
+        inputOffset -= n;
+        return frames;
+    }
+
+private:
+
+    size_t stride() const {
+        return (size_t) (bank->taps - 1 + maxInputFrames);
+    }
+};
+
+#endif /* LeiaAUResampler_h */
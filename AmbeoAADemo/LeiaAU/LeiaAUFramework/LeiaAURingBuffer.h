@@ -0,0 +1,122 @@
+/**
+ * Copyright (c) Sennheiser Electronic GmbH & Co. KG, 2018. All Rights Reserved.
+ *
+ * Distributed as part of the AMBEO Augmented Audio Developers Program.
+ * You may only use this code under the terms stated in LICENSE.md, which was distributed alongside this code.
+ */
+
+#ifndef LeiaAURingBuffer_h
+#define LeiaAURingBuffer_h
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+/**
+ * A lock-free single producer, single consumer ring buffer of samples.
+ *
+ * The storage is followed by a guard region mirroring its first `guardFrames` samples, so
+ * the consumer can always read up to `guardFrames` samples from one contiguous pointer, even
+ * across the wrap. This lets the render thread hand ring memory directly to the Leia engine.
+ *
+ * init() allocates, and attach() uses memory provided by the caller (see LeiaAUSourcePool.h).
+ * Either must be called before either thread uses the ring.
+ *
+ * All other functions are wait-free. write() may only be called by the producer thread, and
+ * readPointer() and consume() only by the consumer thread.
+ */
+struct SampleRingBuffer {
+
+    std::vector<float> storage;  // unless attached to external memory
+    float* data = nullptr;
+    size_t capacity = 0;       // a power of two
+    size_t guardFrames = 0;
+    std::atomic<size_t> writeIndex{0};
+    std::atomic<size_t> readIndex{0};
+
+    /** @param minCapacity  rounded up to a power of two. */
+    void init(size_t minCapacity, size_t inGuardFrames) {
+        setSize(minCapacity, inGuardFrames);
+        storage.assign(capacity + guardFrames, 0.0f);
+        data = storage.data();
+        clear();
+    }
+
+    /** Uses `memory`, which must hold storageFrames(minCapacity, inGuardFrames) samples, instead of allocating. */
+    void attach(float* memory, size_t minCapacity, size_t inGuardFrames) {
+        setSize(minCapacity, inGuardFrames);
+        storage.clear();
+        storage.shrink_to_fit();
+        data = memory;
+        clear();
+    }
+
+    /** @return the number of samples a ring of this size stores, including the guard region. */
+    static size_t storageFrames(size_t minCapacity, size_t inGuardFrames) {
+        SampleRingBuffer ring;
+        ring.setSize(minCapacity, inGuardFrames);
+        return ring.capacity + ring.guardFrames;
+    }
+
+    /** Resets the ring to empty. Neither thread may use the ring meanwhile. */
+    void clear() {
+        writeIndex.store(0, std::memory_order_relaxed);
+        readIndex.store(0, std::memory_order_relaxed);
+    }
+
+    /** @return the number of samples the consumer can read. */
+    size_t readable() const {
+        return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_relaxed);
+    }
+
+    /** @return the number of samples the producer can write. */
+    size_t writable() const {
+        return capacity - (writeIndex.load(std::memory_order_relaxed) - readIndex.load(std::memory_order_acquire));
+    }
+
+    /**
+     * Producer: appends up to n samples.
+     *
+     * @return the number of samples written.
+     */
+    size_t write(const float* samples, size_t n) {
+        n = std::min(n, writable());
+        const size_t start = writeIndex.load(std::memory_order_relaxed) & (capacity - 1);
+        const size_t first = std::min(n, capacity - start);
+        memcpy(data + start, samples, first * sizeof(float));
+        memcpy(data, samples + first, (n - first) * sizeof(float));
+        // Keep the guard region in sync with the samples at the start of the storage.
+        if (start < guardFrames) {
+            memcpy(data + capacity + start, samples, (std::min(first, guardFrames - start)) * sizeof(float));
+        }
+        if (n > first) {
+            memcpy(data + capacity, samples + first, std::min(n - first, guardFrames) * sizeof(float));
+        }
+        writeIndex.store(writeIndex.load(std::memory_order_relaxed) + n, std::memory_order_release);
+        return n;
+    }
+
+    /**
+     * Consumer: the next readable samples, contiguous for up to guardFrames samples.
+     * The samples remain valid until they are consumed.
+     */
+    const float* readPointer() const {
+        return data + (readIndex.load(std::memory_order_relaxed) & (capacity - 1));
+    }
+
+    /** Consumer: releases n samples to the producer. */
+    void consume(size_t n) {
+        readIndex.store(readIndex.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+private:
+
+    void setSize(size_t minCapacity, size_t inGuardFrames) {
+        capacity = 1;
+        while (capacity < minCapacity) { capacity <<= 1; }
+        guardFrames = std::min(inGuardFrames, capacity);
+    }
+};
+
+#endif /* LeiaAURingBuffer_h */
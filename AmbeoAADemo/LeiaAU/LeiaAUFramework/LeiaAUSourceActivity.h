@@ -0,0 +1,335 @@
+/**
+ * Copyright (c) Sennheiser Electronic GmbH & Co. KG, 2018. All Rights Reserved.
+ *
+ * Distributed as part of the AMBEO Augmented Audio Developers Program.
+ * You may only use this code under the terms stated in LICENSE.md, which was distributed alongside this code.
+ */
+
+#ifndef LeiaAUSourceActivity_h
+#define LeiaAUSourceActivity_h
+
+#include "LeiaAUCallRecorder.h"
+#include "SennheiserAmbeoLeia.h"
+
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <vector>
+
+#ifdef __APPLE__
+#include <Accelerate/Accelerate.h>
+#endif
+
+static const float SILENCE_THRESHOLD_POWER = 1e-10f;    // mean square of a silent block, -100 dBFS
+static const float SPEED_OF_SOUND = 343.0f;             // m/s
+static const float TAIL_FILTER_SECONDS = 0.05f;         // allowance for HRTF filters and parameter smoothing
+static const float TAIL_MIN_ABSORPTION = 0.05f;         // lowest mean absorption assumed for a shoebox's reverb time
+
+/**
+ * Life cycle of a tracked source:
+ * EMPTY -> ACTIVE (main thread, add),
+ * ACTIVE -> RETIRING (render thread, with compare-and-swap, once a streaming source and its tail are silent),
+ * RETIRING -> DORMANT (decode thread, after removing the source from the engine),
+ * RETIRING or DORMANT -> ACTIVE (decode thread, once audible audio is decoded, adding it back if needed),
+ * any -> REMOVED (main thread, remove), REMOVED -> EMPTY (release, once no thread uses the slot).
+ * The decode and main threads make their transitions under engineMutex.
+ */
+typedef enum {
+    SOURCE_EMPTY = 0,
+    SOURCE_ACTIVE,
+    SOURCE_RETIRING,
+    SOURCE_DORMANT,
+    SOURCE_REMOVED
+} SourceActivityState;
+
+struct SourceActivity {
+    std::atomic<int> state{SOURCE_EMPTY};
+    int sourceId = 0;
+    bool streaming = false;                         // whether the source's audio is decoded ahead
+    std::atomic<float> x{0.0f}, y{0.0f}, z{0.0f};   // Leia coordinates
+    std::atomic<float> minimumDistance{NAN};        // NAN until set
+    int64_t silentFrames = 0;                       // render thread, while ACTIVE
+};
+
+/**
+ * SourceActivityTracker takes silent streaming sources out of the Leia engine, so it no longer
+ * processes them.
+ *
+ * The engine processes every source it knows of in each block, and its API offers no way to
+ * pause one: leia_process() takes the input of all sources. A silent source only stops costing
+ * engine time once it is removed. Removing and adding engine sources allocates, so that must not
+ * happen on the render thread, and a source added back only plays from its next block. Only
+ * sources whose audio is known ahead can therefore leave the engine: streaming sources, whose
+ * decode thread sees their audio up to a ring buffer ahead of the render thread (see
+ * LeiaAUSourceStreamer.h). Input bus sources stay in the engine, as their audio only arrives
+ * with each render call.
+ *
+ * The render thread measures a streaming source's input per block, and once it has been silent
+ * longer than the source's tail could ring on, and no audible audio is decoded ahead, the source
+ * retires: the engine is pointed at a block of silence, and its input is no longer handed to it.
+ * The decode thread then removes the source from the engine. As soon as it decodes audible audio
+ * for the source, it adds the source back at its latest position and minimum distance, well
+ * before that audio reaches the render thread. The engine's output for the source had decayed
+ * when it was removed, so it resumes without a glitch.
+ *
+ * A source's tail is estimated conservatively from its distance to the listener and the
+ * environment: the reflection paths within, and the Sabine reverberation time of, a shoebox
+ * with little absorption. Materials are not taken into account.
+ *
+ * init() allocates; process() is real-time safe. Sources are added, removed and moved by the
+ * main thread, process() is called by the thread that renders the engine, and update() by the
+ * decode thread.
+ */
+struct SourceActivityTracker {
+
+    std::vector<SourceActivity> slots;
+    std::vector<float> silence;                     // handed to the engine for retiring sources
+    float sampleRate = 0.0f;
+    CallRecorder* recorder = nullptr;
+    std::mutex engineMutex;                         // serializes adding and removing engine sources
+    std::atomic<bool> enabled{true};
+    std::atomic<float> environmentTailSeconds{0.0f};
+    std::atomic<float> reflectionPathMeters{0.0f};
+    std::atomic<float> listenerX{0.0f}, listenerY{0.0f}, listenerZ{0.0f};
+
+    /** @param maxBlockFrames  The largest number of frames process() is called with. */
+    void init(int capacity, float inSampleRate, int maxBlockFrames, CallRecorder* inRecorder) {
+        slots = std::vector<SourceActivity>(capacity);
+        silence.assign((size_t) maxBlockFrames, 0.0f);
+        sampleRate = inSampleRate;
+        recorder = inRecorder;
+    }
+
+    /**
+     * Main thread: adds a source to the engine, and tracks it.
+     *
+     * @param streaming  Whether the source's audio is decoded ahead, so it can leave the engine while silent.
+     * @return the source's slot, or -1 if all slots are in use; the source is then added but not tracked.
+     */
+    int add(LeiaInstance* leia, int sourceId, float px, float py, float pz, bool streaming) {
+        std::lock_guard<std::mutex> lock(engineMutex);
+        recorder->record(LEIA_CALL_SOURCE_ADD, sourceId, 3, px, py, pz);
+        leia_source_add(leia, sourceId, px, py, pz);
+        for (int slot = 0; slot < (int) slots.size(); ++slot) {
+            SourceActivity& s = slots[slot];
+            if (s.state.load(std::memory_order_acquire) != SOURCE_EMPTY) { continue; }
+            s.sourceId = sourceId;
+            s.streaming = streaming;
+            s.x.store(px);
+            s.y.store(py);
+            s.z.store(pz);
+            s.minimumDistance.store(NAN);
+            s.silentFrames = 0;
+            s.state.store(SOURCE_ACTIVE, std::memory_order_release);
+            return slot;
+        }
+        return -1;
+    }
+
+    /**
+     * Main thread: removes a source from the engine, and stops tracking it. Its slot is not reused
+     * until release() is called, once no thread renders the source anymore.
+     *
+     * @return the source's slot, or -1 if it was not tracked.
+     */
+    int remove(LeiaInstance* leia, int sourceId) {
+        std::lock_guard<std::mutex> lock(engineMutex);
+        const int slot = find(sourceId);
+        const int state = slot >= 0 ? slots[slot].state.exchange(SOURCE_REMOVED) : SOURCE_ACTIVE;
+        if (state != SOURCE_DORMANT) {
+            recorder->record(LEIA_CALL_SOURCE_REMOVE, sourceId);
+            leia_source_remove(leia, sourceId);
+        }
+        return slot;
+    }
+
+    /** Makes the slot of a removed source available to new sources. */
+    void release(int slot) {
+        if (slot < 0) { return; }
+        int expected = SOURCE_REMOVED;
+        slots[slot].state.compare_exchange_strong(expected, SOURCE_EMPTY);
+    }
+
+    /** Main thread: moves a source; its distance to the listener bounds the length of its tail. */
+    void setPosition(LeiaInstance* leia, int sourceId, float px, float py, float pz) {
+        std::lock_guard<std::mutex> lock(engineMutex);
+        const int slot = find(sourceId);
+        if (slot >= 0) {
+            SourceActivity& s = slots[slot];
+            s.x.store(px);
+            s.y.store(py);
+            s.z.store(pz);
+            // A dormant source gets its latest position when it is added back.
+            if (s.state.load() == SOURCE_DORMANT) { return; }
+        }
+        recorder->record(LEIA_CALL_SOURCE_POSITION_UPDATE, sourceId, 3, px, py, pz);
+        leia_source_position_update(leia, sourceId, px, py, pz);
+    }
+
+    void setMinimumDistance(LeiaInstance* leia, int sourceId, float distance) {
+        std::lock_guard<std::mutex> lock(engineMutex);
+        const int slot = find(sourceId);
+        if (slot >= 0) {
+            slots[slot].minimumDistance.store(distance);
+            if (slots[slot].state.load() == SOURCE_DORMANT) { return; }
+        }
+        recorder->record(LEIA_CALL_SOURCE_MINIMUM_DISTANCE_SET, sourceId, 1, distance);
+        leia_source_minimum_distance_gain_limit_set(leia, sourceId, distance);
+    }
+
+    void setListenerPosition(float px, float py, float pz) {
+        listenerX.store(px);
+        listenerY.store(py);
+        listenerZ.store(pz);
+    }
+
+    void setFreefieldEnvironment() {
+        environmentTailSeconds.store(0.0f);
+        reflectionPathMeters.store(0.0f);
+    }
+
+    void setShoeboxEnvironment(float width, float length, float height) {
+        const float volume = width * length * height;
+        const float surface = 2.0f * (width * length + width * height + length * height);
+        const float diagonal = std::sqrt(width * width + length * length + height * height);
+        environmentTailSeconds.store(0.161f * volume / (surface * TAIL_MIN_ABSORPTION));
+        reflectionPathMeters.store(2.0f * diagonal);
+    }
+
+    /** While disabled, every source is fed its input, and dormant sources are added back to the engine. */
+    void setEnabled(bool inEnabled) {
+        enabled.store(inEnabled);
+    }
+
+    int find(int sourceId) const {
+        for (int slot = 0; slot < (int) slots.size(); ++slot) {
+            const int state = slots[slot].state.load(std::memory_order_acquire);
+            if (state != SOURCE_EMPTY && state != SOURCE_REMOVED && slots[slot].sourceId == sourceId) { return slot; }
+        }
+        return -1;
+    }
+
+    /** @return whether `slot` still tracks the source `sourceId`. */
+    bool tracks(int slot, int sourceId) const {
+        const int state = slots[slot].state.load(std::memory_order_acquire);
+        return state != SOURCE_EMPTY && state != SOURCE_REMOVED && slots[slot].sourceId == sourceId;
+    }
+
+    /** @return the number of tracked sources. */
+    int registeredCount() const {
+        return countStates(false);
+    }
+
+    /** @return the number of tracked sources the engine processes; retired and dormant ones are not counted. */
+    int activeCount() const {
+        return countStates(true);
+    }
+
+    /**
+     * Render thread, or the RenderAheadPipeline worker while rendering ahead: measures a source's
+     * input for this block, and retires a streaming source once it and its tail are silent.
+     * Makes no call that allocates: sources are never added to or removed from the engine here.
+     *
+     * @param audibleAhead  Whether audible audio of a streaming source is decoded beyond this block.
+     * @return whether to hand the buffer to the engine this block.
+     */
+    bool process(LeiaInstance* leia, int slot, const float* buffer, int n, bool audibleAhead = false) {
+        if (slot < 0) { return true; }
+        SourceActivity& s = slots[slot];
+        int state = s.state.load(std::memory_order_acquire);
+        if (state != SOURCE_ACTIVE) { return false; }
+        if (!s.streaming) { return true; }
+
+        if (audibleAhead || !enabled.load(std::memory_order_relaxed) || !isSilent(buffer, n)) {
+            s.silentFrames = 0;
+            return true;
+        }
+        s.silentFrames += n;
+        if (s.silentFrames < tailFrames(s)) { return true; }
+        if (!s.state.compare_exchange_strong(state, SOURCE_RETIRING)) { return false; }
+        // The engine keeps reading the last buffer it was given until the decode thread removes the source.
+        recorder->recordAudio(s.sourceId, silence.data(), (int) silence.size());
+        leia_source_audio_update(leia, s.sourceId, silence.data(), (int) silence.size());
+        return false;
+    }
+
+    /**
+     * Decode thread: removes a retired source from the engine, or adds a dormant source back
+     * once audible audio is decoded for it.
+     *
+     * @param audibleAhead  Whether audible audio of the source is decoded but not yet rendered.
+     */
+    void update(LeiaInstance* leia, int slot, bool audibleAhead) {
+        if (slot < 0) { return; }
+        SourceActivity& s = slots[slot];
+        const int state = s.state.load(std::memory_order_acquire);
+        if (state != SOURCE_RETIRING && state != SOURCE_DORMANT) { return; }
+        const bool wake = audibleAhead || !enabled.load(std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(engineMutex);
+        if (s.state.load() != state) { return; }   // removed meanwhile
+        if (state == SOURCE_RETIRING && wake) {
+            s.silentFrames = 0;
+            s.state.store(SOURCE_ACTIVE, std::memory_order_release);
+        } else if (state == SOURCE_RETIRING) {
+            recorder->record(LEIA_CALL_SOURCE_REMOVE, s.sourceId);
+            leia_source_remove(leia, s.sourceId);
+            s.state.store(SOURCE_DORMANT, std::memory_order_release);
+        } else if (wake) {
+            const float px = s.x.load(), py = s.y.load(), pz = s.z.load();
+            recorder->record(LEIA_CALL_SOURCE_ADD, s.sourceId, 3, px, py, pz);
+            leia_source_add(leia, s.sourceId, px, py, pz);
+            const float distance = s.minimumDistance.load();
+            if (!std::isnan(distance)) {
+                recorder->record(LEIA_CALL_SOURCE_MINIMUM_DISTANCE_SET, s.sourceId, 1, distance);
+                leia_source_minimum_distance_gain_limit_set(leia, s.sourceId, distance);
+            }
+            s.silentFrames = 0;
+            s.state.store(SOURCE_ACTIVE, std::memory_order_release);
+        }
+    }
+
+    /** @return whether a block's mean square is below the silence threshold. */
+    static bool isSilent(const float* buffer, int n) {
+        return meanSquare(buffer, n) < SILENCE_THRESHOLD_POWER;
+    }
+
+private:
+
+    /** @return how long the engine's output of a source can last after its input fell silent. */
+    int64_t tailFrames(const SourceActivity& s) const {
+        const float dx = s.x.load(std::memory_order_relaxed) - listenerX.load(std::memory_order_relaxed);
+        const float dy = s.y.load(std::memory_order_relaxed) - listenerY.load(std::memory_order_relaxed);
+        const float dz = s.z.load(std::memory_order_relaxed) - listenerZ.load(std::memory_order_relaxed);
+        const float pathMeters = std::sqrt(dx * dx + dy * dy + dz * dz) + reflectionPathMeters.load(std::memory_order_relaxed);
+        const float seconds = pathMeters / SPEED_OF_SOUND + environmentTailSeconds.load(std::memory_order_relaxed)
+                            + TAIL_FILTER_SECONDS;
+        return (int64_t) (seconds * sampleRate);
+    }
+
+    int countStates(bool activeOnly) const {
+        int count = 0;
+        for (const SourceActivity& s : slots) {
+            const int state = s.state.load(std::memory_order_relaxed);
+            if (activeOnly ? state == SOURCE_ACTIVE : state != SOURCE_EMPTY && state != SOURCE_REMOVED) { ++count; }
+        }
+        return count;
+    }
+
+    static float meanSquare(const float* buffer, int n) {
+        if (n <= 0) { return 0.0f; }
+#ifdef __APPLE__
+        float result;
+        vDSP_measqv(buffer, 1, &result, (vDSP_Length) n);
+        return result;
+#else
+        float sum = 0.0f;
+        for (int i = 0; i < n; ++i) {
+            sum += buffer[i] * buffer[i];
+        }
+        return sum / (float) n;
+#endif
+    }
+};
+
+#endif /* LeiaAUSourceActivity_h */
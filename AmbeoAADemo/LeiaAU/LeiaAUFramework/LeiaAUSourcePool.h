@@ -0,0 +1,157 @@
+/**
+ * Copyright (c) Sennheiser Electronic GmbH & Co. KG, 2018. All Rights Reserved.
+ *
+ * Distributed as part of the AMBEO Augmented Audio Developers Program.
+ * You may only use this code under the terms stated in LICENSE.md, which was distributed alongside this code.
+ */
+
+#ifndef LeiaAUSourcePool_h
+#define LeiaAUSourcePool_h
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+static const size_t CACHE_LINE_BYTES = 64;
+
+/**
+ * One contiguous, cache-line aligned allocation, divided into equally sized slots of per-source
+ * state. Slot i belongs to the i-th source of a fixed-size source array, so iterating over the
+ * sources walks the memory linearly, and no two sources share a cache line.
+ *
+ * reserve() allocates, and no other thread may use any slot meanwhile. slot() is real-time safe.
+ */
+struct SourceArena {
+
+    void* memory = nullptr;
+    size_t slotBytes = 0;
+    int numSlots = 0;
+
+    SourceArena() = default;
+    SourceArena(const SourceArena&) = delete;
+    SourceArena& operator=(const SourceArena&) = delete;
+
+    ~SourceArena() {
+        release();
+    }
+
+    /**
+     * Replaces the arena by one of `count` zeroed slots of at least `minSlotBytes` each.
+     *
+     * @return false if the memory could not be allocated; the arena is then empty.
+     */
+    bool reserve(int count, size_t minSlotBytes) {
+        release();
+        if (count <= 0) { return true; }
+        slotBytes = (minSlotBytes + CACHE_LINE_BYTES - 1) / CACHE_LINE_BYTES * CACHE_LINE_BYTES;
+        if (posix_memalign(&memory, CACHE_LINE_BYTES, slotBytes * (size_t) count) != 0) {
+            memory = nullptr;
+            slotBytes = 0;
+            return false;
+        }
+        memset(memory, 0, slotBytes * (size_t) count);
+        numSlots = count;
+        return true;
+    }
+
+    void release() {
+        free(memory);
+        memory = nullptr;
+        slotBytes = 0;
+        numSlots = 0;
+    }
+
+    int capacity() const {
+        return numSlots;
+    }
+
+    void* slot(int i) const {
+        return (char*) memory + (size_t) i * slotBytes;
+    }
+};
+
+/**
+ * The sources fed by LeiaAU's input busses: entry i is the source of input bus i.
+ * The table has a fixed capacity and never allocates.
+ */
+template <int Capacity>
+struct BusSourceTable {
+
+    struct Entry {
+        int sourceId;
+        int activitySlot;   // the source's slot in the SourceActivityTracker, or -1
+    };
+
+    struct Snapshot {
+        int count = 0;
+        Entry entries[Capacity];
+    };
+
+    /**
+     * The table is double buffered: the main thread edits the snapshot the render thread does not
+     * read, then publishes it. Before it edits a snapshot again, it waits until the render thread
+     * has let go of it, which takes at most one render cycle. So entries, and the activity slots
+     * they name, are never reused while the render thread may still see them.
+     */
+    Snapshot snapshots[2];
+    std::atomic<int> published{0};
+    std::atomic<int> reading{-1};   // the snapshot the render thread holds, or -1
+
+    /** Main thread: @return false if the table is full. */
+    bool add(int sourceId, int activitySlot) {
+        const Snapshot& current = snapshots[published.load()];
+        if (current.count == Capacity) { return false; }
+        Snapshot& next = snapshots[1 - published.load()];
+        next = current;
+        next.entries[next.count++] = Entry{sourceId, activitySlot};
+        publish();
+        return true;
+    }
+
+    /** Main thread: removes a source; the sources of later busses move up by one bus. @return false if not found. */
+    bool remove(int sourceId) {
+        const Snapshot& current = snapshots[published.load()];
+        Snapshot& next = snapshots[1 - published.load()];
+        next.count = 0;
+        for (int i = 0; i < current.count; ++i) {
+            if (current.entries[i].sourceId != sourceId) { next.entries[next.count++] = current.entries[i]; }
+        }
+        if (next.count == current.count) { return false; }
+        publish();
+        return true;
+    }
+
+    /** Main thread: the current sources, valid until the next add() or remove(). */
+    const Snapshot& current() const {
+        return snapshots[published.load()];
+    }
+
+    /** Render thread: takes the current snapshot for this render cycle. */
+    const Snapshot& acquire() {
+        int index;
+        do {
+            index = published.load();
+            reading.store(index);
+        } while (published.load() != index);
+        return snapshots[index];
+    }
+
+    /** Render thread: lets go of the snapshot taken by acquire(). */
+    void release() {
+        reading.store(-1);
+    }
+
+private:
+
+    void publish() {
+        const int previous = published.load();
+        published.store(1 - previous);
+        while (reading.load() == previous) {
+            std::this_thread::yield(); // the render thread is in the middle of a cycle with the previous snapshot
+        }
+    }
+};
+
+#endif /* LeiaAUSourcePool_h */
@@ -0,0 +1,366 @@
+/**
+ * Copyright (c) Sennheiser Electronic GmbH & Co. KG, 2018. All Rights Reserved.
+ *
+ * Distributed as part of the AMBEO Augmented Audio Developers Program.
+ * You may only use this code under the terms stated in LICENSE.md, which was distributed alongside this code.
+ */
+
+#ifndef LeiaAUSourceStreamer_h
+#define LeiaAUSourceStreamer_h
+
+#include <AudioToolbox/ExtendedAudioFile.h>
+
+#include "LeiaAUCallRecorder.h"
+#include "LeiaAURingBuffer.h"
+#include "LeiaAUSourceActivity.h"
+#include "LeiaAUSourcePool.h"
+#include "SennheiserAmbeoLeia.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+static const int MAX_NUM_STREAMING_SOURCES = 256;
+static const size_t STREAM_RING_FRAMES = 1 << 15;    // ~0.7 s of prefetched audio per source at 44.1 kHz
+static const UInt32 STREAM_DECODE_FRAMES = 4096;     // frames decoded per file read
+static const int STREAM_DECODE_INTERVAL_MS = 5;      // how often the decode thread tops up the rings
+
+/**
+ * Life cycle of a StreamingSource slot. Each transition is made by one thread only:
+ * EMPTY -> STARTING (main thread, add),
+ * STARTING -> ACTIVE (decode thread, once the ring is filled; with compare-and-swap, so a concurrent remove wins),
+ * STARTING or ACTIVE -> REMOVING (main thread, remove),
+ * REMOVING -> RETIRED (render thread, once it no longer uses the ring; the RenderAheadPipeline
+ * worker while rendering ahead),
+ * RETIRED -> EMPTY (decode thread, after closing the file).
+ */
+typedef enum {
+    STREAM_EMPTY = 0,
+    STREAM_STARTING,
+    STREAM_ACTIVE,
+    STREAM_REMOVING,
+    STREAM_RETIRED
+} StreamState;
+
+/**
+ * A file-backed source, decoded ahead of time into its own ring buffer.
+ */
+struct StreamingSource {
+    std::atomic<int> state{STREAM_EMPTY};
+    int sourceId = 0;
+    int activitySlot = -1;                   // the source's slot in the SourceActivityTracker
+    bool loop = false;
+    ExtAudioFileRef file = nullptr;
+    SampleRingBuffer ring;
+    float* scratch = nullptr;                // holds a block when the ring cannot supply it (render thread)
+    std::vector<float> scratchStorage;       // only for slots beyond the reserved ones
+    size_t pendingConsume = 0;               // frames handed to the engine this block (render thread)
+    std::atomic<size_t> audibleEnd{0};       // the ring's write index after the last audible chunk decoded
+    std::atomic<bool> endOfFile{false};
+    std::atomic<uint32_t> underruns{0};      // blocks the ring could not fill before the end of the file
+};
+
+/**
+ * SourceStreamer decodes file-backed sources on a background thread into per-source
+ * single producer, single consumer rings. The render thread passes ring memory directly
+ * to leia_source_audio_update(), so no file I/O or decoding happens on the audio thread.
+ *
+ * Files are decoded to mono float at the engine sample rate by ExtAudioFile. A new source is
+ * fed silence until the decode thread has filled its ring, so adding one does not decode on
+ * the main thread. The decode thread also notes which decoded audio is audible, so that it can
+ * add a silent source back to the engine before its audio is due (see LeiaAUSourceActivity.h).
+ *
+ * The rings and scratch blocks of the first reserve() slots come from one SourceArena, so adding
+ * and removing those sources does not allocate them. Only opening a file still allocates, within
+ * ExtAudioFile; that happens on the main thread. Sources beyond the reserved slots allocate their
+ * buffers when they are added.
+ */
+struct SourceStreamer {
+
+    StreamingSource streams[MAX_NUM_STREAMING_SOURCES];
+    LeiaInstance* leia = nullptr;
+    SourceActivityTracker* activity = nullptr;
+    double sampleRate = 0.0;
+    int maxBlockFrames = 0;
+    std::atomic<bool> renderingEnabled{false};
+    std::atomic<bool> running{false};
+    std::thread decodeThread;
+    std::vector<float> decodeBuffer;         // decode thread only
+    SourceArena arena;
+
+    void init(LeiaInstance* inLeia, SourceActivityTracker* inActivity, double inSampleRate, int inMaxBlockFrames) {
+        leia = inLeia;
+        activity = inActivity;
+        sampleRate = inSampleRate;
+        maxBlockFrames = inMaxBlockFrames;
+        decodeBuffer.assign(STREAM_DECODE_FRAMES, 0.0f);
+    }
+
+    /**
+     * Main thread: preallocates the buffers of `count` streaming sources, replacing any earlier reservation.
+     *
+     * @return false if streaming sources are in use, or the memory could not be allocated.
+     */
+    bool reserve(int count) {
+        count = std::min(count, MAX_NUM_STREAMING_SOURCES);
+        for (const StreamingSource& s : streams) {
+            if (s.state.load(std::memory_order_acquire) != STREAM_EMPTY) { return false; }
+        }
+        const size_t ringFrames = SampleRingBuffer::storageFrames(STREAM_RING_FRAMES, (size_t) maxBlockFrames);
+        if (!arena.reserve(count, (ringFrames + (size_t) maxBlockFrames) * sizeof(float))) { return false; }
+        // Slots beyond the reservation get their buffers when a source is added to them.
+        for (int i = 0; i < count; ++i) {
+            float* memory = (float*) arena.slot(i);
+            streams[i].ring.attach(memory, STREAM_RING_FRAMES, (size_t) maxBlockFrames);
+            streams[i].scratch = memory + ringFrames;
+            streams[i].scratchStorage = std::vector<float>();
+        }
+        return true;
+    }
+
+    ~SourceStreamer() {
+        stop();
+    }
+
+    /** Stops the decode thread and closes all files. */
+    void stop() {
+        if (running.exchange(false)) {
+            decodeThread.join();
+        }
+        for (StreamingSource& s : streams) {
+            closeFile(s);
+            if (s.state.exchange(STREAM_EMPTY) == STREAM_RETIRED) {
+                activity->release(s.activitySlot);
+            }
+        }
+    }
+
+    /**
+     * Main thread: opens a file, and has the decode thread prefetch its start before the render thread plays it.
+     *
+     * @param activitySlot  The source's slot in the SourceActivityTracker, or -1.
+     *
+     * @return false if the file cannot be opened, or all slots are in use.
+     */
+    bool add(int sourceId, const char* path, bool loop, int activitySlot) {
+        // Reserved slots come first, so they are used before any slot that allocates.
+        int slot = 0;
+        while (slot < MAX_NUM_STREAMING_SOURCES && streams[slot].state.load(std::memory_order_acquire) != STREAM_EMPTY) {
+            ++slot;
+        }
+        if (slot == MAX_NUM_STREAMING_SOURCES) { return false; }
+        StreamingSource* s = &streams[slot];
+        if (!openFile(*s, path)) { return false; }
+
+        s->sourceId = sourceId;
+        s->activitySlot = activitySlot;
+        s->loop = loop;
+        if (slot < arena.capacity()) {
+            s->ring.clear();
+        } else {
+            s->ring.init(STREAM_RING_FRAMES, (size_t) maxBlockFrames);
+            s->scratchStorage.assign((size_t) maxBlockFrames, 0.0f);
+            s->scratch = s->scratchStorage.data();
+        }
+        s->pendingConsume = 0;
+        s->audibleEnd.store(0);
+        s->endOfFile.store(false);
+        s->underruns.store(0);
+
+        s->state.store(STREAM_STARTING, std::memory_order_release);
+        startDecodeThread();
+        return true;
+    }
+
+    /**
+     * Main thread: stops feeding a source. Its slot, and its slot in the SourceActivityTracker, which
+     * must be removed from the tracker first, are released once the render thread has let go of it.
+     *
+     * @return false if no streaming source has this ID.
+     */
+    bool remove(int sourceId) {
+        StreamingSource* s = find(sourceId);
+        if (s == nullptr) { return false; }
+        s->state.store(renderingEnabled.load() ? STREAM_REMOVING : STREAM_RETIRED, std::memory_order_release);
+        return true;
+    }
+
+    uint32_t underrunCount(int sourceId) const {
+        const StreamingSource* s = find(sourceId);
+        return s != nullptr ? s->underruns.load(std::memory_order_relaxed) : 0;
+    }
+
+    /** Called when rendering starts or stops; while stopped, removals complete immediately. */
+    void setRenderingEnabled(bool enabled) {
+        renderingEnabled.store(enabled);
+        if (enabled) { return; }
+        for (StreamingSource& s : streams) {
+            int expected = STREAM_REMOVING;
+            s.state.compare_exchange_strong(expected, STREAM_RETIRED);
+        }
+    }
+
+    /**
+     * Render thread: hands the next n <= maxBlockFrames frames of every active source to the engine.
+     * Sources that are silent are taken out of the engine by `activity`.
+     * The frames stay reserved until advance() is called after processing.
+     */
+    void feedEngine(LeiaInstance* leia, int n, SourceActivityTracker* activity, CallRecorder* recorder) {
+        for (StreamingSource& s : streams) {
+            const int state = s.state.load(std::memory_order_acquire);
+            if (state != STREAM_ACTIVE && state != STREAM_STARTING) { continue; }
+            const size_t available = s.ring.readable();
+            float* buffer;
+            if (state == STREAM_STARTING) {
+                // The decode thread is still filling the ring; the source starts once it is full.
+                buffer = s.scratch;
+                memset(buffer, 0, (size_t) n * sizeof(float));
+                s.pendingConsume = 0;
+            } else if (available >= (size_t) n) {
+                // Zero-copy: the guard region makes up to maxBlockFrames frames contiguous.
+                buffer = (float*) s.ring.readPointer();
+                s.pendingConsume = (size_t) n;
+            } else {
+                if (!s.endOfFile.load(std::memory_order_acquire)) {
+                    s.underruns.fetch_add(1, std::memory_order_relaxed);
+                }
+                buffer = s.scratch;
+                memcpy(buffer, s.ring.readPointer(), available * sizeof(float));
+                memset(buffer + available, 0, (n - available) * sizeof(float));
+                s.pendingConsume = available;
+            }
+            const bool audibleAhead = s.audibleEnd.load(std::memory_order_acquire) > s.ring.readIndex.load(std::memory_order_relaxed) + n;
+            if (!activity->process(leia, s.activitySlot, buffer, n, audibleAhead)) { continue; }
+            recorder->recordAudio(s.sourceId, buffer, n);
+            leia_source_audio_update(leia, s.sourceId, buffer, n);
+        }
+    }
+
+    /** Render thread: releases the frames handed to the engine by feedEngine(). */
+    void advance() {
+        for (StreamingSource& s : streams) {
+            const int state = s.state.load(std::memory_order_acquire);
+            if (state != STREAM_ACTIVE && state != STREAM_REMOVING) { continue; }
+            s.ring.consume(s.pendingConsume);
+            s.pendingConsume = 0;
+            if (state == STREAM_REMOVING) {
+                s.state.store(STREAM_RETIRED, std::memory_order_release);
+            }
+        }
+    }
+
+private:
+
+    StreamingSource* find(int sourceId) {
+        for (StreamingSource& s : streams) {
+            const int state = s.state.load(std::memory_order_acquire);
+            if ((state == STREAM_ACTIVE || state == STREAM_STARTING) && s.sourceId == sourceId) { return &s; }
+        }
+        return nullptr;
+    }
+
+    const StreamingSource* find(int sourceId) const {
+        return const_cast<SourceStreamer*>(this)->find(sourceId);
+    }
+
+    void startDecodeThread() {
+        if (running.exchange(true)) { return; }
+        decodeThread = std::thread([this] { decodeLoop(); });
+    }
+
+    void decodeLoop() {
+        while (running.load()) {
+            for (StreamingSource& s : streams) {
+                const int state = s.state.load(std::memory_order_acquire);
+                if (state == STREAM_ACTIVE) {
+                    while (decode(s, decodeBuffer.data())) {}
+                    const bool audibleAhead = s.audibleEnd.load(std::memory_order_relaxed) > s.ring.readIndex.load(std::memory_order_acquire);
+                    activity->update(leia, s.activitySlot, audibleAhead);
+                } else if (state == STREAM_STARTING) {
+                    while (decode(s, decodeBuffer.data())) {}
+                    int expected = STREAM_STARTING;
+                    s.state.compare_exchange_strong(expected, STREAM_ACTIVE);
+                } else if (state == STREAM_RETIRED) {
+                    // The render thread no longer uses the source's activity slot either.
+                    closeFile(s);
+                    activity->release(s.activitySlot);
+                    s.state.store(STREAM_EMPTY, std::memory_order_release);
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(STREAM_DECODE_INTERVAL_MS));
+        }
+    }
+
+    /**
+     * Decodes one chunk into the ring, if it has room for it.
+     *
+     * @return true if more can be decoded right away.
+     */
+    bool decode(StreamingSource& s, float* buffer) {
+        if (s.endOfFile.load(std::memory_order_relaxed) || s.ring.writable() < STREAM_DECODE_FRAMES) { return false; }
+        UInt32 frames = STREAM_DECODE_FRAMES;
+        AudioBufferList bufferList;
+        bufferList.mNumberBuffers = 1;
+        bufferList.mBuffers[0].mNumberChannels = 1;
+        bufferList.mBuffers[0].mDataByteSize = frames * sizeof(float);
+        bufferList.mBuffers[0].mData = buffer;
+        if (ExtAudioFileRead(s.file, &frames, &bufferList) != noErr) {
+            printf("LeiaAU - ERROR: failed to decode streaming source %d.\n", s.sourceId);
+            s.endOfFile.store(true, std::memory_order_release);
+            return false;
+        }
+        if (frames == 0) {
+            if (s.loop) {
+                // Continue from the start on the next call, so an empty file cannot spin here.
+                ExtAudioFileSeek(s.file, 0);
+                return false;
+            }
+            s.endOfFile.store(true, std::memory_order_release);
+            return false;
+        }
+        s.ring.write(buffer, frames);
+        if (!SourceActivityTracker::isSilent(buffer, (int) frames)) {
+            s.audibleEnd.store(s.ring.writeIndex.load(std::memory_order_relaxed), std::memory_order_release);
+        }
+        return true;
+    }
+
+    bool openFile(StreamingSource& s, const char* path) {
+        CFURLRef url = CFURLCreateFromFileSystemRepresentation(nullptr, (const UInt8*) path, (CFIndex) strlen(path), false);
+        OSStatus err = ExtAudioFileOpenURL(url, &s.file);
+        CFRelease(url);
+        if (err != noErr) {
+            printf("LeiaAU - ERROR: could not open streaming source file %s (%d).\n", path, (int) err);
+            s.file = nullptr;
+            return false;
+        }
+        AudioStreamBasicDescription clientFormat = {};
+        clientFormat.mSampleRate = sampleRate;
+        clientFormat.mFormatID = kAudioFormatLinearPCM;
+        clientFormat.mFormatFlags = kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked | kAudioFormatFlagsNativeEndian;
+        clientFormat.mChannelsPerFrame = 1;
+        clientFormat.mBitsPerChannel = 32;
+        clientFormat.mFramesPerPacket = 1;
+        clientFormat.mBytesPerFrame = sizeof(float);
+        clientFormat.mBytesPerPacket = sizeof(float);
+        err = ExtAudioFileSetProperty(s.file, kExtAudioFileProperty_ClientDataFormat, sizeof(clientFormat), &clientFormat);
+        if (err != noErr) {
+            printf("LeiaAU - ERROR: could not decode streaming source file %s to mono float (%d).\n", path, (int) err);
+            closeFile(s);
+            return false;
+        }
+        return true;
+    }
+
+    void closeFile(StreamingSource& s) {
+        if (s.file != nullptr) {
+            ExtAudioFileDispose(s.file);
+            s.file = nullptr;
+        }
+    }
+};
+
+#endif /* LeiaAUSourceStreamer_h */
@@ -0,0 +1,233 @@
+/**
+ * Copyright (c) Sennheiser Electronic GmbH & Co. KG, 2018. All Rights Reserved.
+ *
+ * Distributed as part of the AMBEO Augmented Audio Developers Program.
+ * You may only use this code under the terms stated in LICENSE.md, which was distributed alongside this code.
+ */
+
+#ifndef LeiaAUTableFile_h
+#define LeiaAUTableFile_h
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+/**
+ * On-disk layout of a LeiaAU table file.
+ *
+ * A table file holds data derived offline for exactly one sample rate and maximum block size,
+ * so that LeiaAU can map it read-only at initialization instead of computing it. The file
+ * consists of a TableFileHeader, followed by `numSections` TableSectionEntry records, followed
+ * by the section payloads. Every payload starts on a TABLE_FILE_ALIGNMENT boundary, so it can be
+ * used in place by SIMD code without copying. Mapped pages are shared between all processes that
+ * map the same file (e.g. the host app and the audio unit extension) through the page cache.
+ *
+ * All values are stored in the native byte order of the baking machine; a file whose magic does
+ * not match is rejected.
+ */
+
+static const uint32_t TABLE_FILE_MAGIC = 0x4c415442; // 'LATB'
+static const uint32_t TABLE_FILE_VERSION = 1;
+static const uint64_t TABLE_FILE_ALIGNMENT = 64;
+
+/** Element formats of a table section payload. */
+typedef enum {
+    TABLE_FORMAT_FLOAT32 = 0,
+    TABLE_FORMAT_FLOAT16,    // IEEE 754 half precision
+    TABLE_FORMAT_INT8        // int8 with float scales; the section's tag defines their layout
+} TableSectionFormat;
+
+struct TableFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sampleRate;
+    uint32_t maxBlockSize;
+    uint32_t numSections;
+    uint32_t reserved[3];
+};
+
+struct TableSectionEntry {
+    uint32_t tag;       // what the section contains
+    uint32_t param0;    // tag specific key, e.g. a source sample rate
+    uint32_t param1;    // tag specific key, e.g. a target sample rate
+    uint32_t format;    // a TableSectionFormat
+    uint64_t offset;    // byte offset of the payload from the start of the file
+    uint64_t byteSize;  // byte size of the payload
+};
+
+static_assert(sizeof(TableFileHeader) == 32, "TableFileHeader layout must not change within a version.");
+static_assert(sizeof(TableSectionEntry) == 32, "TableSectionEntry layout must not change within a version.");
+
+#pragma mark - MappedTableFile
+
+/**
+ * A read-only memory mapping of a table file.
+ */
+struct MappedTableFile {
+
+    const uint8_t* base = nullptr;
+    size_t mappedSize = 0;
+
+    MappedTableFile() = default;
+    MappedTableFile(const MappedTableFile&) = delete;
+    MappedTableFile& operator=(const MappedTableFile&) = delete;
+    ~MappedTableFile() { unmap(); }
+
+    /**
+     * Maps the table file at `path`. Fails if the file is missing, truncated, of another
+     * version, or was baked for a different sample rate or maximum block size.
+     *
+     * @return true if the file was mapped.
+     */
+    bool map(const char* path, uint32_t sampleRate, uint32_t maxBlockSize) {
+        unmap();
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) { return false; }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(TableFileHeader)) {
+            close(fd);
+            return false;
+        }
+        void* address = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd); // the mapping keeps its own reference to the file
+        if (address == MAP_FAILED) { return false; }
+        base = (const uint8_t*) address;
+        mappedSize = (size_t) st.st_size;
+
+        if (!isValid(sampleRate, maxBlockSize)) {
+            printf("LeiaAU - WARNING: ignoring table file %s (wrong version, rate, block size or truncated)\n", path);
+            unmap();
+            return false;
+        }
+        return true;
+    }
+
+    void unmap() {
+        if (base != nullptr) {
+            munmap((void*) base, mappedSize);
+        }
+        base = nullptr;
+        mappedSize = 0;
+    }
+
+    bool isMapped() const {
+        return base != nullptr;
+    }
+
+    const TableFileHeader* header() const {
+        return (const TableFileHeader*) base;
+    }
+
+    /**
+     * Looks up a section payload by its tag and keys.
+     *
+     * @param byteSize  If not null, receives the payload size in bytes.
+     * @return  The aligned payload, or nullptr if no such section exists (or nothing is mapped).
+     */
+    const void* section(uint32_t tag, uint32_t param0, uint32_t param1, uint32_t format, uint64_t* byteSize) const {
+        if (!isMapped()) { return nullptr; }
+        const TableSectionEntry* entries = (const TableSectionEntry*) (base + sizeof(TableFileHeader));
+        for (uint32_t i = 0; i < header()->numSections; ++i) {
+            const TableSectionEntry& e = entries[i];
+            if (e.tag == tag && e.param0 == param0 && e.param1 == param1 && e.format == format) {
+                if (byteSize != nullptr) { *byteSize = e.byteSize; }
+                return base + e.offset;
+            }
+        }
+        return nullptr;
+    }
+
+private:
+
+    bool isValid(uint32_t sampleRate, uint32_t maxBlockSize) const {
+        const TableFileHeader* h = header();
+        if (h->magic != TABLE_FILE_MAGIC || h->version != TABLE_FILE_VERSION) { return false; }
+        if (h->sampleRate != sampleRate || h->maxBlockSize != maxBlockSize) { return false; }
+        uint64_t entriesEnd = sizeof(TableFileHeader) + (uint64_t) h->numSections * sizeof(TableSectionEntry);
+        if (entriesEnd > mappedSize) { return false; }
+        const TableSectionEntry* entries = (const TableSectionEntry*) (base + sizeof(TableFileHeader));
+        for (uint32_t i = 0; i < h->numSections; ++i) {
+            const TableSectionEntry& e = entries[i];
+            if (e.offset % TABLE_FILE_ALIGNMENT != 0 || e.offset < entriesEnd) { return false; }
+            // Written so that a corrupt offset or size cannot overflow.
+            if (e.offset > mappedSize || e.byteSize > mappedSize - e.offset) { return false; }
+        }
+        return true;
+    }
+};
+
+#pragma mark - TableFileWriter
+
+/**
+ * Collects table sections and writes them out in the table file layout.
+ * Used by the offline baking tool; never used on the audio thread.
+ */
+struct TableFileWriter {
+
+    struct PendingSection {
+        TableSectionEntry entry;
+        std::vector<uint8_t> payload;
+    };
+
+    uint32_t sampleRate = 0;
+    uint32_t maxBlockSize = 0;
+    std::vector<PendingSection> sections;
+
+    TableFileWriter(uint32_t inSampleRate, uint32_t inMaxBlockSize)
+        : sampleRate(inSampleRate), maxBlockSize(inMaxBlockSize) {}
+
+    void addSection(uint32_t tag, uint32_t param0, uint32_t param1, uint32_t format,
+                    const void* data, uint64_t byteSize) {
+        PendingSection s;
+        s.entry = TableSectionEntry{tag, param0, param1, format, 0, byteSize};
+        s.payload.assign((const uint8_t*) data, (const uint8_t*) data + byteSize);
+        sections.push_back(s);
+    }
+
+    /** @return true if the file was written completely. */
+    bool write(const char* path) {
+        TableFileHeader h = {};
+        h.magic = TABLE_FILE_MAGIC;
+        h.version = TABLE_FILE_VERSION;
+        h.sampleRate = sampleRate;
+        h.maxBlockSize = maxBlockSize;
+        h.numSections = (uint32_t) sections.size();
+
+        // Lay out the payloads after the section table, each on an aligned offset.
+        uint64_t offset = sizeof(TableFileHeader) + sections.size() * sizeof(TableSectionEntry);
+        for (PendingSection& s : sections) {
+            offset = alignUp(offset);
+            s.entry.offset = offset;
+            offset += s.entry.byteSize;
+        }
+
+        FILE* file = fopen(path, "wb");
+        if (file == nullptr) { return false; }
+        bool ok = fwrite(&h, sizeof(h), 1, file) == 1;
+        for (const PendingSection& s : sections) {
+            ok = ok && fwrite(&s.entry, sizeof(s.entry), 1, file) == 1;
+        }
+        uint64_t position = sizeof(TableFileHeader) + sections.size() * sizeof(TableSectionEntry);
+        static const uint8_t zeros[TABLE_FILE_ALIGNMENT] = {};
+        for (const PendingSection& s : sections) {
+            ok = ok && fwrite(zeros, 1, (size_t) (s.entry.offset - position), file) == s.entry.offset - position;
+            ok = ok && (s.payload.empty() || fwrite(s.payload.data(), 1, s.payload.size(), file) == s.payload.size());
+            position = s.entry.offset + s.entry.byteSize;
+        }
+        return fclose(file) == 0 && ok;
+    }
+
+private:
+
+    static uint64_t alignUp(uint64_t value) {
+        return (value + TABLE_FILE_ALIGNMENT - 1) & ~(TABLE_FILE_ALIGNMENT - 1);
+    }
+};
+
+#endif /* LeiaAUTableFile_h */
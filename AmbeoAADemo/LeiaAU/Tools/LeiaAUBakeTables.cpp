@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) Sennheiser Electronic GmbH & Co. KG, 2018. All Rights Reserved.
+ *
+ * Distributed as part of the AMBEO Augmented Audio Developers Program.
+ * You may only use this code under the terms stated in LICENSE.md, which was distributed alongside this code.
+ */
+
+// Offline tool that bakes the derived tables of LeiaAU for one sample rate and
+// maximum block size into a table file (see LeiaAUTableFile.h). Add the output
+// to the LeiaAUFramework bundle as `LeiaAUTables.bin` and LeiaAU will map it at
+// initialization instead of computing the tables itself.
+//
+// Build and run on the development machine:
+//
+//   clang++ -std=c++14 -O2 -I../LeiaAUFramework LeiaAUBakeTables.cpp -o LeiaAUBakeTables
+//   ./LeiaAUBakeTables LeiaAUTables.bin 44100 512
+
+#include "LeiaAUResampler.h"
+#include "LeiaAUTableFile.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+/** A function adding the sections of one kind of table to the writer. */
+typedef void (*TableBaker)(TableFileWriter& writer);
+
+/** Coefficient formats baked for each filter bank, so LeiaAU finds its RESAMPLER_COEFFICIENT_FORMAT. */
+static const int BANK_FORMATS[] = {TABLE_FORMAT_FLOAT32, TABLE_FORMAT_FLOAT16, TABLE_FORMAT_INT8};
+
+static void addBank(TableFileWriter& writer, int inputRate, int outputRate) {
+    for (int format : BANK_FORMATS) {
+        PolyphaseFilterBank bank;
+        bank.design(inputRate, outputRate);
+        bank.compact(format);
+        writer.addSection(TABLE_POLYPHASE_BANK, inputRate, outputRate, format,
+                          bank.payload(), bank.payloadSize(format));
+    }
+}
+
+/** Bakes the polyphase filter banks of LeiaAU's input and output resamplers. */
+static void bakePolyphaseBanks(TableFileWriter& writer) {
+    const int engineRate = (int) writer.sampleRate;
+    for (int hostRate : HOST_SAMPLE_RATES) {
+        if (hostRate == engineRate) { continue; }
+        addBank(writer, hostRate, engineRate);
+        addBank(writer, engineRate, hostRate);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s <output file> <sample rate> <max block size>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char* path = argv[1];
+    const int sampleRate = atoi(argv[2]);
+    const int maxBlockSize = atoi(argv[3]);
+    if (sampleRate <= 0 || maxBlockSize <= 0) {
+        fprintf(stderr, "sample rate and max block size must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    TableFileWriter writer((uint32_t) sampleRate, (uint32_t) maxBlockSize);
+
+    std::vector<TableBaker> bakers = {bakePolyphaseBanks};
+    for (TableBaker bake : bakers) {
+        bake(writer);
+    }
+
+    if (!writer.write(path)) {
+        fprintf(stderr, "failed to write %s\n", path);
+        return EXIT_FAILURE;
+    }
+    printf("Wrote %zu table sections for %d Hz / %d frames to %s\n",
+           writer.sections.size(), sampleRate, maxBlockSize, path);
+    return EXIT_SUCCESS;
+}
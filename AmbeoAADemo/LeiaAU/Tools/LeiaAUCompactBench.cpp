@@ -0,0 +1,176 @@
+/**
+ * Copyright (c) Sennheiser Electronic GmbH & Co. KG, 2018. All Rights Reserved.
+ *
+ * Distributed as part of the AMBEO Augmented Audio Developers Program.
+ * You may only use this code under the terms stated in LICENSE.md, which was distributed alongside this code.
+ */
+
+// Offline tool that measures the compact resampler coefficient formats (see
+// LeiaAUCompactFloat.h) against the float32 filter banks they are made from.
+// For each sample rate conversion of LeiaAU, it reports the max and RMS error of
+// dotHalf() and dotInt8() against the float32 dot product, the error of whole
+// resampled signals, and the time the resampler takes in each format. It fails
+// if an error exceeds the bounds below, so run it after changing the kernels.
+//
+// Build and run on the development machine, for the target's instruction set:
+//
+//   clang++ -std=c++14 -O2 -I../LeiaAUFramework LeiaAUCompactBench.cpp -o LeiaAUCompactBench
+//   ./LeiaAUCompactBench 44100
+//
+// On x86, add -mavx2 -mf16c to time the vector kernels; without them, float16
+// falls back to scalar conversion.
+
+#include "LeiaAUResampler.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+static const int BENCH_CHANNELS = 8;         // MAX_NUM_SOURCES of LeiaAU
+static const int BENCH_BLOCK_FRAMES = 512;   // host frames per resampler call
+static const double BENCH_SECONDS = 10.0;    // audio resampled per timing run
+static const int KERNEL_WINDOWS = 2000;      // random input windows per phase for the kernel errors
+
+/** Largest acceptable RMS error of a resampled signal, in dB relative to full scale; float32 is the reference. */
+static const double MAX_RMS_ERROR_DB[] = {0.0, -70.0, -38.0};   // float32, float16, int8
+
+static const char* FORMAT_NAMES[] = {"float32", "float16", "int8"};
+static const int FORMATS[] = {TABLE_FORMAT_FLOAT32, TABLE_FORMAT_FLOAT16, TABLE_FORMAT_INT8};
+
+struct ErrorStats {
+    double maxError = 0.0;
+    double sumSquares = 0.0;
+    size_t count = 0;
+
+    void add(double error) {
+        maxError = std::max(maxError, std::fabs(error));
+        sumSquares += error * error;
+        ++count;
+    }
+
+    double rms() const {
+        return count > 0 ? std::sqrt(sumSquares / count) : 0.0;
+    }
+};
+
+static double toDb(double value) {
+    return 20.0 * std::log10(std::max(value, 1e-15));
+}
+
+/** Errors of the compact dot products against the float32 one, over random input windows. */
+static ErrorStats kernelError(const PolyphaseFilterBank& reference, const PolyphaseFilterBank& bank, std::mt19937& random) {
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    std::vector<float> x((size_t) reference.taps);
+    ErrorStats stats;
+    for (int p = 0; p < reference.upFactor; ++p) {
+        for (int w = 0; w < KERNEL_WINDOWS / reference.upFactor + 1; ++w) {
+            for (float& sample : x) { sample = uniform(random); }
+            stats.add((double) bank.dot(x.data(), p) - reference.dot(x.data(), p));
+        }
+    }
+    return stats;
+}
+
+/** A test signal of full-scale sines and noise, different in each channel. */
+static std::vector<float> testSignal(int frames, int rate, std::mt19937& random) {
+    std::normal_distribution<float> noise(0.0f, 0.1f);
+    std::vector<float> signal((size_t) BENCH_CHANNELS * frames);
+    for (int c = 0; c < BENCH_CHANNELS; ++c) {
+        const double frequency = 440.0 * (c + 1) * std::min(1.0, rate / 48000.0);
+        for (int i = 0; i < frames; ++i) {
+            const double sine = 0.8 * std::sin(2.0 * M_PI * frequency * i / rate);
+            signal[(size_t) c * frames + i] = (float) sine + noise(random);
+        }
+    }
+    return signal;
+}
+
+/** Resamples all channels of `signal` block by block. @return the output, BENCH_CHANNELS channels of `outputFrames`. */
+static std::vector<float> resample(const PolyphaseFilterBank& bank, const std::vector<float>& signal, int frames,
+                                   int& outputFrames, double& seconds) {
+    PolyphaseResampler resampler;
+    resampler.init(&bank, BENCH_CHANNELS, BENCH_BLOCK_FRAMES);
+    const int capacity = resampler.maxOutputFrames(BENCH_BLOCK_FRAMES) * (frames / BENCH_BLOCK_FRAMES + 1);
+    std::vector<float> output((size_t) BENCH_CHANNELS * capacity, 0.0f);
+    outputFrames = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int offset = 0; offset + BENCH_BLOCK_FRAMES <= frames; offset += BENCH_BLOCK_FRAMES) {
+        const float* in[BENCH_CHANNELS];
+        float* out[BENCH_CHANNELS];
+        for (int c = 0; c < BENCH_CHANNELS; ++c) {
+            in[c] = signal.data() + (size_t) c * frames + offset;
+            out[c] = output.data() + (size_t) c * capacity + outputFrames;
+        }
+        outputFrames += resampler.process(in, out, BENCH_CHANNELS, BENCH_BLOCK_FRAMES);
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // Pack the channels at outputFrames apart.
+    std::vector<float> packed((size_t) BENCH_CHANNELS * outputFrames);
+    for (int c = 0; c < BENCH_CHANNELS; ++c) {
+        std::copy(output.begin() + (size_t) c * capacity, output.begin() + (size_t) c * capacity + outputFrames,
+                  packed.begin() + (size_t) c * outputFrames);
+    }
+    return packed;
+}
+
+/** Measures one conversion in all formats. @return false if an error exceeds its bound. */
+static bool measure(int inputRate, int outputRate, std::mt19937& random) {
+    PolyphaseFilterBank banks[3];
+    for (int f = 0; f < 3; ++f) {
+        banks[f].design(inputRate, outputRate);
+        banks[f].compact(FORMATS[f]);
+    }
+    printf("%6d -> %6d Hz  (L %d, M %d, %d taps)\n", inputRate, outputRate, banks[0].upFactor, banks[0].downFactor, banks[0].taps);
+
+    const int frames = (int) (BENCH_SECONDS * inputRate) / BENCH_BLOCK_FRAMES * BENCH_BLOCK_FRAMES;
+    const std::vector<float> signal = testSignal(frames, inputRate, random);
+    std::vector<float> outputs[3];
+    int outputFrames = 0;
+    double seconds[3];
+    for (int f = 0; f < 3; ++f) {
+        outputs[f] = resample(banks[f], signal, frames, outputFrames, seconds[f]);
+    }
+
+    bool ok = true;
+    for (int f = 0; f < 3; ++f) {
+        const ErrorStats kernel = kernelError(banks[0], banks[f], random);
+        ErrorStats signalError;
+        for (size_t i = 0; i < outputs[f].size(); ++i) {
+            signalError.add((double) outputs[f][i] - outputs[0][i]);
+        }
+        const double rmsDb = toDb(signalError.rms());
+        const bool withinBound = f == 0 || rmsDb <= MAX_RMS_ERROR_DB[f];
+        ok = ok && withinBound;
+        printf("  %-8s  dot max %.3g rms %.3g  |  signal max %6.1f dB rms %6.1f dB  |  %7.2f ns per channel frame, %5.0fx real time%s\n",
+               FORMAT_NAMES[f], kernel.maxError, kernel.rms(), toDb(signalError.maxError), rmsDb,
+               1e9 * seconds[f] / ((double) outputFrames * BENCH_CHANNELS), frames / (double) inputRate / seconds[f],
+               withinBound ? "" : "  EXCEEDS BOUND");
+    }
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <engine sample rate>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const int engineRate = atoi(argv[1]);
+    if (engineRate <= 0) {
+        fprintf(stderr, "the engine sample rate must be positive\n");
+        return EXIT_FAILURE;
+    }
+    printf("Errors against the float32 bank; signal errors relative to full scale. Timed with %d channels, %d frame blocks.\n",
+           BENCH_CHANNELS, BENCH_BLOCK_FRAMES);
+
+    std::mt19937 random(1);
+    bool ok = true;
+    for (int hostRate : HOST_SAMPLE_RATES) {
+        if (hostRate == engineRate) { continue; }
+        ok = measure(hostRate, engineRate, random) && ok;
+        ok = measure(engineRate, hostRate, random) && ok;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,229 @@
+/**
+ * Copyright (c) Sennheiser Electronic GmbH & Co. KG, 2018. All Rights Reserved.
+ *
+ * Distributed as part of the AMBEO Augmented Audio Developers Program.
+ * You may only use this code under the terms stated in LICENSE.md, which was distributed alongside this code.
+ */
+
+#ifndef LeiaAURenderProtocol_h
+#define LeiaAURenderProtocol_h
+
+#include "LeiaAUCallRecorder.h"
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * Protocol between the Leia render server (LeiaAURenderServer.cpp) and its client processes.
+ *
+ * A client connects to the server's Unix domain socket and sends a RenderHello within a second,
+ * or the server closes the connection. The server answers with a RenderWelcome, which carries
+ * the file descriptor of a shared memory RenderChannel for this client. From then on, all
+ * communication goes through lock-free rings in the channel:
+ *
+ *   - commands: the Leia calls changing the scene, as CallRecords (see LeiaAUCallRecorder.h).
+ *     Source IDs are private to each client; the server maps them to engine source IDs.
+ *   - input:    one block of audio for the client's sources per server block.
+ *   - output:   the binaural output of the engine, one block per server block.
+ *
+ * The output ring starts with RENDER_LATENCY_BLOCKS blocks of silence, so a client which
+ * submits one input block and then takes one output block per period hears its sources
+ * after a fixed latency of RenderWelcome::latencyFrames. The socket stays open for the
+ * lifetime of the client; the server releases the client's sources when it closes.
+ */
+
+static const uint32_t RENDER_PROTOCOL_MAGIC = 0x4c524e44; // 'LRND'
+static const uint32_t RENDER_PROTOCOL_VERSION = 2;
+static const int RENDER_MAX_BLOCK_FRAMES = 512;
+static const int RENDER_MAX_CLIENT_SOURCES = 32;
+static const uint32_t RENDER_COMMAND_RING_SIZE = 1024;  // commands
+static const uint32_t RENDER_BLOCK_RING_SIZE = 8;       // audio blocks, in each direction
+static const uint32_t RENDER_LATENCY_BLOCKS = 2;        // silent blocks the output ring starts with
+static const char* const RENDER_DEFAULT_SOCKET_PATH = "/tmp/leia-render.sock";
+
+typedef enum {
+    RENDER_STATUS_OK = 0,
+    RENDER_STATUS_VERSION_MISMATCH,
+    RENDER_STATUS_SERVER_FULL,
+    RENDER_STATUS_OUT_OF_MEMORY
+} RenderStatus;
+
+struct RenderHello {
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct RenderWelcome {
+    uint32_t magic;
+    uint32_t version;
+    int32_t status;           // a RenderStatus; the channel's descriptor is only attached if OK
+    uint32_t sampleRate;
+    uint32_t blockFrames;     // every block in either direction has exactly this many frames
+    uint32_t latencyFrames;   // from submitting an input block to receiving its output
+    uint32_t channelSize;     // size of the shared RenderChannel, in bytes
+    uint32_t clientIndex;
+};
+
+/**
+ * A single producer, single consumer ring of fixed-size items in shared memory.
+ * Items are written and read in place: the producer fills writeSlot() and commits it with
+ * commitWrite(), the consumer reads readSlot() and releases it with commitRead().
+ */
+template <typename T, uint32_t N>
+struct SharedRing {
+    static_assert((N & (N - 1)) == 0, "The ring size must be a power of two.");
+
+    alignas(64) std::atomic<uint32_t> writeIndex;
+    alignas(64) std::atomic<uint32_t> readIndex;
+    alignas(64) T items[N];
+
+    void init() {
+        writeIndex.store(0, std::memory_order_relaxed);
+        readIndex.store(0, std::memory_order_relaxed);
+    }
+
+    /** Producer: @return the next free item, or nullptr if the ring is full. */
+    T* writeSlot() {
+        const uint32_t w = writeIndex.load(std::memory_order_relaxed);
+        if (w - readIndex.load(std::memory_order_acquire) == N) { return nullptr; }
+        return &items[w & (N - 1)];
+    }
+
+    void commitWrite() {
+        writeIndex.store(writeIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /** Producer: copies an item into the ring. @return false if the ring is full. */
+    bool push(const T& item) {
+        T* slot = writeSlot();
+        if (slot == nullptr) { return false; }
+        *slot = item;
+        commitWrite();
+        return true;
+    }
+
+    /** Consumer: @return the oldest item, or nullptr if the ring is empty. */
+    const T* readSlot() const {
+        const uint32_t r = readIndex.load(std::memory_order_relaxed);
+        if (writeIndex.load(std::memory_order_acquire) == r) { return nullptr; }
+        return &items[r & (N - 1)];
+    }
+
+    void commitRead() {
+        readIndex.store(readIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
+
+/** Audio of a client's sources for one block. Sources not listed receive silence. */
+struct RenderInputBlock {
+    int32_t numSources;
+    int32_t sourceIds[RENDER_MAX_CLIENT_SOURCES];
+    float samples[RENDER_MAX_CLIENT_SOURCES][RENDER_MAX_BLOCK_FRAMES];
+};
+
+struct RenderOutputBlock {
+    float samples[2][RENDER_MAX_BLOCK_FRAMES];   // binaural left and right
+};
+
+/** The shared memory of one client. Created and initialized by the server. */
+struct RenderChannel {
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint32_t> inputUnderruns;    // server blocks without an input block from the client
+    std::atomic<uint32_t> outputOverruns;    // output blocks dropped because the client did not take them
+    std::atomic<uint32_t> droppedCommands;   // commands rejected by the server, e.g. for invalid source IDs
+    SharedRing<CallRecord, RENDER_COMMAND_RING_SIZE> commands;
+    SharedRing<RenderInputBlock, RENDER_BLOCK_RING_SIZE> input;
+    SharedRing<RenderOutputBlock, RENDER_BLOCK_RING_SIZE> output;
+};
+
+#pragma mark - RenderClient
+
+/**
+ * Client side of the handshake. After connect(), the client drives the rings of `channel`
+ * directly; none of its operations block or allocate.
+ */
+struct RenderClient {
+
+    int socket = -1;
+    RenderChannel* channel = nullptr;
+    RenderWelcome welcome = {};
+
+    ~RenderClient() {
+        disconnect();
+    }
+
+    /** @return the server's RenderStatus, or -1 if the server could not be reached. */
+    int connect(const char* socketPath = RENDER_DEFAULT_SOCKET_PATH) {
+        disconnect();
+        socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+        if (socket < 0 || ::connect(socket, (sockaddr*) &address, sizeof(address)) != 0) {
+            disconnect();
+            return -1;
+        }
+
+        const RenderHello hello = { RENDER_PROTOCOL_MAGIC, RENDER_PROTOCOL_VERSION };
+        int channelFd = -1;
+        if (write(socket, &hello, sizeof(hello)) != (ssize_t) sizeof(hello)
+            || !receiveWelcome(channelFd)) {
+            disconnect();
+            return -1;
+        }
+        if (welcome.status != RENDER_STATUS_OK) {
+            const int status = welcome.status;
+            disconnect();
+            return status;
+        }
+        void* memory = mmap(nullptr, welcome.channelSize, PROT_READ | PROT_WRITE, MAP_SHARED, channelFd, 0);
+        close(channelFd);
+        if (memory == MAP_FAILED) {
+            disconnect();
+            return RENDER_STATUS_OUT_OF_MEMORY;
+        }
+        channel = (RenderChannel*) memory;
+        return RENDER_STATUS_OK;
+    }
+
+    void disconnect() {
+        if (channel != nullptr) {
+            munmap(channel, welcome.channelSize);
+            channel = nullptr;
+        }
+        if (socket >= 0) {
+            close(socket);
+            socket = -1;
+        }
+    }
+
+private:
+
+    bool receiveWelcome(int& channelFd) {
+        char control[CMSG_SPACE(sizeof(int))] = {};
+        iovec io = { &welcome, sizeof(welcome) };
+        msghdr message = {};
+        message.msg_iov = &io;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(socket, &message, MSG_WAITALL) != (ssize_t) sizeof(welcome)
+            || welcome.magic != RENDER_PROTOCOL_MAGIC) {
+            return false;
+        }
+        cmsghdr* header = CMSG_FIRSTHDR(&message);
+        if (header != nullptr && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+            memcpy(&channelFd, CMSG_DATA(header), sizeof(int));
+        }
+        return welcome.status != RENDER_STATUS_OK || channelFd >= 0;
+    }
+};
+
+#endif /* LeiaAURenderProtocol_h */
@@ -0,0 +1,390 @@
+/**
+ * Copyright (c) Sennheiser Electronic GmbH & Co. KG, 2018. All Rights Reserved.
+ *
+ * Distributed as part of the AMBEO Augmented Audio Developers Program.
+ * You may only use this code under the terms stated in LICENSE.md, which was distributed alongside this code.
+ */
+
+// Render server: one Leia engine instance shared by several client processes on one host
+// (see LeiaAURenderProtocol.h). All clients' sources are rendered in one scene, with one
+// listener and one environment, so the late field and the reflections are computed once; every
+// client receives the binaural output of the whole scene.
+//
+// The engine runs on its own thread, optionally pinned to one CPU core (Linux only), and
+// processes one block per block period of its own clock. Clients must therefore run from a
+// clock of the same rate; a client that falls behind receives silence for its sources and
+// counts inputUnderruns, one that runs ahead counts outputOverruns. The main thread accepts
+// clients and sets up and tears down their shared memory, so the render thread never blocks.
+//
+// Build and run on the host (macOS or Linux), linked against a build of libSennheiserAmbeoLeia:
+//
+//   clang++ -std=c++14 -O2 -pthread -I../LeiaAUFramework -I../../../Leia LeiaAURenderServer.cpp
+//           -L<path of libSennheiserAmbeoLeia> -lSennheiserAmbeoLeia -o LeiaAURenderServer
+//   ./LeiaAURenderServer [socket path] [cpu core]
+
+#include "LeiaAURenderProtocol.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <thread>
+
+static const LeiaSampleRate SAMPLE_RATE = SAMPLERATE_44100;
+static const int FRAME_COUNT = RENDER_MAX_BLOCK_FRAMES;
+static const int MAX_NUM_CLIENTS = 8;
+static const int HANDSHAKE_TIMEOUT_MS = 1000;  // how long a connecting client may take to send its hello
+
+/**
+ * Life cycle of a client slot, like StreamState in LeiaAUSourceStreamer.h:
+ * EMPTY -> ACTIVE (main thread, after the handshake), ACTIVE -> CLOSING (main thread, on hang-up),
+ * CLOSING -> CLOSED (render thread, after removing the client's sources),
+ * CLOSED -> EMPTY (main thread, after unmapping the channel).
+ */
+typedef enum {
+    CLIENT_EMPTY = 0,
+    CLIENT_ACTIVE,
+    CLIENT_CLOSING,
+    CLIENT_CLOSED
+} ClientState;
+
+struct Client {
+    std::atomic<int> state{CLIENT_EMPTY};
+    int socket = -1;
+    RenderChannel* channel = nullptr;
+    bool sourceAdded[RENDER_MAX_CLIENT_SOURCES] = {};   // render thread only
+};
+
+static Client clients[MAX_NUM_CLIENTS];
+static std::atomic<bool> running{true};
+
+static void handleSignal(int) {
+    running.store(false);
+}
+
+/** Client source IDs are private to each client; each client owns a range of engine source IDs. */
+static int engineSourceId(int clientIndex, int sourceId) {
+    return clientIndex * RENDER_MAX_CLIENT_SOURCES + sourceId;
+}
+
+static bool isSourceCall(uint16_t call) {
+    return call == LEIA_CALL_SOURCE_ADD || call == LEIA_CALL_SOURCE_REMOVE
+        || call == LEIA_CALL_SOURCE_POSITION_UPDATE || call == LEIA_CALL_SOURCE_MINIMUM_DISTANCE_SET;
+}
+
+#pragma mark - Render thread
+
+/** Makes the client's queued calls, with its source IDs mapped to engine source IDs. */
+static void applyCommands(LeiaInstance* leia, int clientIndex, Client& client) {
+    RenderChannel* channel = client.channel;
+    while (const CallRecord* command = channel->commands.readSlot()) {
+        // Copy the call out of shared memory before checking it, so the client cannot change it afterwards.
+        CallRecord r;
+        memcpy(&r, command, sizeof(r));
+        channel->commands.commitRead();
+        if (!validateSceneCall(r)) {
+            channel->droppedCommands.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        if (isSourceCall(r.call)) {
+            if (r.sourceId < 0 || r.sourceId >= RENDER_MAX_CLIENT_SOURCES) {
+                channel->droppedCommands.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            if (r.call == LEIA_CALL_SOURCE_ADD) { client.sourceAdded[r.sourceId] = true; }
+            if (r.call == LEIA_CALL_SOURCE_REMOVE) { client.sourceAdded[r.sourceId] = false; }
+            r.sourceId = engineSourceId(clientIndex, r.sourceId);
+        }
+        if (!applyCall(leia, r)) {
+            channel->droppedCommands.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+/** Hands one block of the client's audio to the engine; sources without audio get silence. */
+static const RenderInputBlock* updateSourceAudio(LeiaInstance* leia, int clientIndex, Client& client, float* silence) {
+    const RenderInputBlock* block = client.channel->input.readSlot();
+    if (block == nullptr) {
+        client.channel->inputUnderruns.fetch_add(1, std::memory_order_relaxed);
+    }
+    bool updated[RENDER_MAX_CLIENT_SOURCES] = {};
+    const int numSources = block != nullptr ? std::min(block->numSources, RENDER_MAX_CLIENT_SOURCES) : 0;
+    for (int i = 0; i < numSources; ++i) {
+        const int sourceId = block->sourceIds[i];
+        if (sourceId < 0 || sourceId >= RENDER_MAX_CLIENT_SOURCES || !client.sourceAdded[sourceId]) { continue; }
+        // The engine reads the shared memory directly; the slot is released after processing.
+        leia_source_audio_update(leia, engineSourceId(clientIndex, sourceId), (float*) block->samples[i], FRAME_COUNT);
+        updated[sourceId] = true;
+    }
+    for (int sourceId = 0; sourceId < RENDER_MAX_CLIENT_SOURCES; ++sourceId) {
+        if (client.sourceAdded[sourceId] && !updated[sourceId]) {
+            leia_source_audio_update(leia, engineSourceId(clientIndex, sourceId), silence, FRAME_COUNT);
+        }
+    }
+    return block;
+}
+
+static void removeSources(LeiaInstance* leia, int clientIndex, Client& client) {
+    for (int sourceId = 0; sourceId < RENDER_MAX_CLIENT_SOURCES; ++sourceId) {
+        if (client.sourceAdded[sourceId]) {
+            leia_source_remove(leia, engineSourceId(clientIndex, sourceId));
+            client.sourceAdded[sourceId] = false;
+        }
+    }
+}
+
+static void pinToCore(int core) {
+#if defined(__linux__)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+        fprintf(stderr, "LeiaAURenderServer - WARNING: could not pin the render thread to core %d.\n", core);
+    }
+#else
+    (void) core;
+    fprintf(stderr, "LeiaAURenderServer - WARNING: pinning threads is not supported on this platform.\n");
+#endif
+}
+
+static void renderLoop(LeiaInstance* leia, int core) {
+    if (core >= 0) { pinToCore(core); }
+    float silence[FRAME_COUNT] = {};
+    float left[FRAME_COUNT], right[FRAME_COUNT];
+    float* out[2] = { left, right };
+    const RenderInputBlock* blocks[MAX_NUM_CLIENTS];
+
+    const auto period = std::chrono::nanoseconds(1000000000LL * FRAME_COUNT / SAMPLE_RATE);
+    auto deadline = std::chrono::steady_clock::now();
+    while (running.load(std::memory_order_relaxed)) {
+        for (int c = 0; c < MAX_NUM_CLIENTS; ++c) {
+            blocks[c] = nullptr;
+            const int state = clients[c].state.load(std::memory_order_acquire);
+            if (state == CLIENT_CLOSING) {
+                removeSources(leia, c, clients[c]);
+                clients[c].state.store(CLIENT_CLOSED, std::memory_order_release);
+            } else if (state == CLIENT_ACTIVE) {
+                applyCommands(leia, c, clients[c]);
+                blocks[c] = updateSourceAudio(leia, c, clients[c], silence);
+            }
+        }
+
+        leia_process_source_audio(leia, out, FRAME_COUNT);
+
+        for (int c = 0; c < MAX_NUM_CLIENTS; ++c) {
+            if (clients[c].state.load(std::memory_order_acquire) != CLIENT_ACTIVE) { continue; }
+            RenderChannel* channel = clients[c].channel;
+            if (blocks[c] != nullptr) { channel->input.commitRead(); }
+            RenderOutputBlock* output = channel->output.writeSlot();
+            if (output == nullptr) {
+                channel->outputOverruns.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            memcpy(output->samples[0], left, sizeof(left));
+            memcpy(output->samples[1], right, sizeof(right));
+            channel->output.commitWrite();
+        }
+
+        deadline += period;
+        const auto now = std::chrono::steady_clock::now();
+        if (deadline < now) {
+            deadline = now; // this block was late; do not try to catch up with a burst
+        }
+        std::this_thread::sleep_until(deadline);
+    }
+}
+
+#pragma mark - Main thread
+
+/** Creates a client's shared memory. @return its descriptor, or -1. */
+static int createChannel(RenderChannel*& channel) {
+    char name[64];
+    snprintf(name, sizeof(name), "/leia-render-%d-%u", (int) getpid(), (unsigned) rand());
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd < 0) { return -1; }
+    shm_unlink(name); // the memory lives on as long as the server or the client maps it
+    void* memory = MAP_FAILED;
+    if (ftruncate(fd, sizeof(RenderChannel)) == 0) {
+        memory = mmap(nullptr, sizeof(RenderChannel), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (memory == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    channel = new (memory) RenderChannel;
+    channel->magic = RENDER_PROTOCOL_MAGIC;
+    channel->version = RENDER_PROTOCOL_VERSION;
+    channel->inputUnderruns.store(0);
+    channel->outputOverruns.store(0);
+    channel->droppedCommands.store(0);
+    channel->commands.init();
+    channel->input.init();
+    channel->output.init();
+    for (uint32_t i = 0; i < RENDER_LATENCY_BLOCKS; ++i) {
+        RenderOutputBlock* block = channel->output.writeSlot();
+        memset(block, 0, sizeof(*block));
+        channel->output.commitWrite();
+    }
+    return fd;
+}
+
+static void sendWelcome(int socket, RenderWelcome welcome, int channelFd) {
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    iovec io = { &welcome, sizeof(welcome) };
+    msghdr message = {};
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    if (channelFd >= 0) {
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(header), &channelFd, sizeof(int));
+    }
+    sendmsg(socket, &message, 0);
+}
+
+/**
+ * Main thread. The handshake blocks for at most HANDSHAKE_TIMEOUT_MS in each direction, so a
+ * client that connects and sends nothing cannot keep the server from tearing down other clients.
+ */
+static void acceptClient(int listener) {
+    const int socket = accept(listener, nullptr, nullptr);
+    if (socket < 0) { return; }
+    const timeval timeout = { HANDSHAKE_TIMEOUT_MS / 1000, (HANDSHAKE_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    RenderHello hello = {};
+    RenderWelcome welcome = { RENDER_PROTOCOL_MAGIC, RENDER_PROTOCOL_VERSION, RENDER_STATUS_OK, SAMPLE_RATE,
+                              FRAME_COUNT, RENDER_LATENCY_BLOCKS * FRAME_COUNT, sizeof(RenderChannel), 0 };
+    if (recv(socket, &hello, sizeof(hello), MSG_WAITALL) != (ssize_t) sizeof(hello)) {
+        printf("LeiaAURenderServer - a client did not complete the handshake.\n");
+        close(socket);
+        return;
+    }
+    if (hello.magic != RENDER_PROTOCOL_MAGIC || hello.version != RENDER_PROTOCOL_VERSION) {
+        welcome.status = RENDER_STATUS_VERSION_MISMATCH;
+        sendWelcome(socket, welcome, -1);
+        close(socket);
+        return;
+    }
+
+    int index = 0;
+    while (index < MAX_NUM_CLIENTS && clients[index].state.load(std::memory_order_acquire) != CLIENT_EMPTY) { ++index; }
+    RenderChannel* channel = nullptr;
+    const int channelFd = index < MAX_NUM_CLIENTS ? createChannel(channel) : -1;
+    if (channelFd < 0) {
+        welcome.status = index < MAX_NUM_CLIENTS ? RENDER_STATUS_OUT_OF_MEMORY : RENDER_STATUS_SERVER_FULL;
+        sendWelcome(socket, welcome, -1);
+        close(socket);
+        return;
+    }
+
+    Client& client = clients[index];
+    client.socket = socket;
+    client.channel = channel;
+    welcome.clientIndex = (uint32_t) index;
+    sendWelcome(socket, welcome, channelFd);
+    close(channelFd);
+    client.state.store(CLIENT_ACTIVE, std::memory_order_release);
+    printf("LeiaAURenderServer - client %d connected.\n", index);
+}
+
+/**
+ * Clients send nothing after the handshake, but data they send anyway is discarded rather than
+ * taken as a hang-up; only an error, a hang-up or the end of the stream closes the connection.
+ */
+static bool clientHungUp(const pollfd& fd) {
+    if (fd.revents & (POLLHUP | POLLERR | POLLNVAL)) { return true; }
+    if (!(fd.revents & POLLIN)) { return false; }
+    char discarded[256];
+    const ssize_t received = recv(fd.fd, discarded, sizeof(discarded), MSG_DONTWAIT);
+    return received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+/** Tears down the shared memory of clients whose sources the render thread has removed. */
+static void releaseClosedClients() {
+    for (int c = 0; c < MAX_NUM_CLIENTS; ++c) {
+        Client& client = clients[c];
+        if (client.state.load(std::memory_order_acquire) != CLIENT_CLOSED) { continue; }
+        printf("LeiaAURenderServer - client %d disconnected (%u input underruns, %u output overruns, %u dropped commands).\n",
+               c, client.channel->inputUnderruns.load(), client.channel->outputOverruns.load(),
+               client.channel->droppedCommands.load());
+        munmap(client.channel, sizeof(RenderChannel));
+        close(client.socket);
+        client.channel = nullptr;
+        client.socket = -1;
+        client.state.store(CLIENT_EMPTY, std::memory_order_release);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const char* socketPath = argc > 1 ? argv[1] : RENDER_DEFAULT_SOCKET_PATH;
+    const int core = argc > 2 ? atoi(argv[2]) : -1;
+
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+    unlink(socketPath);
+    if (listener < 0 || bind(listener, (sockaddr*) &address, sizeof(address)) != 0 || listen(listener, MAX_NUM_CLIENTS) != 0) {
+        fprintf(stderr, "LeiaAURenderServer - ERROR: could not listen on %s.\n", socketPath);
+        return EXIT_FAILURE;
+    }
+
+    LeiaInstance* leia = leia_new(SAMPLE_RATE, FRAME_COUNT);
+    std::thread renderThread(renderLoop, leia, core);
+    printf("LeiaAURenderServer - listening on %s at %d Hz, %d frames per block, %u frames latency.\n",
+           socketPath, (int) SAMPLE_RATE, FRAME_COUNT, RENDER_LATENCY_BLOCKS * FRAME_COUNT);
+
+    while (running.load()) {
+        pollfd fds[MAX_NUM_CLIENTS + 1];
+        int clientOf[MAX_NUM_CLIENTS + 1];
+        nfds_t count = 0;
+        fds[count++] = { listener, POLLIN, 0 };
+        for (int c = 0; c < MAX_NUM_CLIENTS; ++c) {
+            if (clients[c].state.load(std::memory_order_acquire) != CLIENT_ACTIVE) { continue; }
+            clientOf[count] = c;
+            fds[count++] = { clients[c].socket, POLLIN, 0 };
+        }
+        if (poll(fds, count, 100) > 0) {
+            if (fds[0].revents & POLLIN) { acceptClient(listener); }
+            for (nfds_t i = 1; i < count; ++i) {
+                if (clientHungUp(fds[i])) {
+                    clients[clientOf[i]].state.store(CLIENT_CLOSING, std::memory_order_release);
+                }
+            }
+        }
+        releaseClosedClients();
+    }
+
+    renderThread.join();
+    for (Client& client : clients) {
+        if (client.state.load() != CLIENT_EMPTY) {
+            client.state.store(CLIENT_CLOSED);
+        }
+    }
+    releaseClosedClients();
+    leia_delete(leia);
+    close(listener);
+    unlink(socketPath);
+    return EXIT_SUCCESS;
+}
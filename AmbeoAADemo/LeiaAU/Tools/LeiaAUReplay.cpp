@@ -0,0 +1,193 @@
+/**
+ * Copyright (c) Sennheiser Electronic GmbH & Co. KG, 2018. All Rights Reserved.
+ *
+ * Distributed as part of the AMBEO Augmented Audio Developers Program.
+ * You may only use this code under the terms stated in LICENSE.md, which was distributed alongside this code.
+ */
+
+// Replays a Leia call log, recorded by LeiaAU's CallRecorder (see LeiaAUCallRecorder.h),
+// against a fresh Leia instance, and reports the time spent per processed block. The
+// calls are made in the recorded order, so the engine sees exactly the recorded workload,
+// which can then be profiled offline, e.g. with `perf record ./LeiaAUReplay session.leialog`.
+// The log starts with the scene as it was when recording started.
+//
+// With CALL_AUDIO_SAMPLES, the source audio is replayed as well, and the hash of each replayed
+// block is compared with the one recorded; mismatches are reported. With CALL_AUDIO_HASH, blocks
+// whose hash is that of silence are replayed as silence, and all others as deterministic noise,
+// which cannot be verified. Without audio, each source is fed noise.
+//
+// The tool must be linked against a build of libSennheiserAmbeoLeia for the machine it runs on:
+//
+//   clang++ -std=c++14 -O2 -I../LeiaAUFramework -I../../../Leia LeiaAUReplay.cpp
+//           -L<path of libSennheiserAmbeoLeia> -lSennheiserAmbeoLeia -o LeiaAUReplay
+//   ./LeiaAUReplay session.leialog [repetitions]
+
+#include "LeiaAUCallRecorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+/** The outcome of one replay. */
+struct ReplayResult {
+    std::vector<double> blockTimes;       // time spent in each leia_process_source_audio(), in microseconds
+    size_t verifiedBlocks = 0;            // source blocks whose hash was compared
+    size_t mismatchedBlocks = 0;          // ... and differed from the recording
+    size_t silentBlocks = 0;              // source blocks replayed as silence, by their hash
+    size_t invalidRecords = 0;            // records skipped because they do not fit the log
+};
+
+static uint64_t silenceHash(int frames) {
+    static std::map<int, uint64_t> hashes;
+    auto found = hashes.find(frames);
+    if (found != hashes.end()) { return found->second; }
+    const std::vector<float> silence((size_t) frames, 0.0f);
+    return hashes[frames] = fnv1aHash(silence.data(), silence.size() * sizeof(float));
+}
+
+static void fillNoise(std::vector<float>& buffer, int sourceId, uint64_t block) {
+    uint32_t state = (uint32_t) (sourceId * 2654435761u) ^ (uint32_t) (block * 40503u) ^ 0x9e3779b9u;
+    for (float& sample : buffer) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        sample = 0.1f * ((float) (state & 0xffff) / 32768.0f - 1.0f); // about -20 dBFS
+    }
+}
+
+/**
+ * Reads a log. The samples following audio updates are collected into `samples`, and each such
+ * update's samplePosition is set to the index of its first sample there.
+ */
+static bool readLog(const char* path, CallLogHeader& header, std::vector<CallRecord>& records, std::vector<float>& samples) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) { return false; }
+    bool ok = fread(&header, sizeof(header), 1, file) == 1
+        && header.magic == CALL_LOG_MAGIC && header.version == CALL_LOG_VERSION;
+    CallRecord r;
+    while (ok && fread(&r, sizeof(r), 1, file) == 1) {
+        if (header.audioMode == CALL_AUDIO_SAMPLES && r.call == LEIA_CALL_SOURCE_AUDIO_UPDATE && r.count == 1) {
+            // The frame count sizes the read, so it must be valid for the rest of the log to be.
+            if (r.frames <= 0 || r.frames > (int) header.maxBlockSize) {
+                fprintf(stderr, "audio update with %d frames; the log is corrupt\n", r.frames);
+                ok = false;
+                break;
+            }
+            r.payload.audio.samplePosition = samples.size();
+            samples.resize(samples.size() + (size_t) r.frames);
+            if (fread(samples.data() + r.payload.audio.samplePosition, sizeof(float), (size_t) r.frames, file) != (size_t) r.frames) {
+                fprintf(stderr, "the log ends within the samples of an audio update\n");
+                samples.resize(r.payload.audio.samplePosition);
+                break;
+            }
+        }
+        records.push_back(r);
+    }
+    fclose(file);
+    return ok;
+}
+
+static ReplayResult replay(const CallLogHeader& header, const std::vector<CallRecord>& records, const std::vector<float>& samples) {
+    LeiaInstance* leia = leia_new((LeiaSampleRate) header.sampleRate, (int) header.maxBlockSize);
+    std::map<int, std::vector<float>> audio;
+    std::vector<float> left(header.maxBlockSize), right(header.maxBlockSize);
+    float* out[2] = { left.data(), right.data() };
+    ReplayResult result;
+
+    for (const CallRecord& r : records) {
+        if (applyCall(leia, r)) { continue; }
+        switch (r.call) {
+            case LEIA_CALL_SOURCE_AUDIO_UPDATE: {
+                if (r.frames <= 0 || r.frames > (int) header.maxBlockSize) {
+                    ++result.invalidRecords;
+                    break;
+                }
+                std::vector<float>& buffer = audio[r.sourceId];
+                buffer.resize(header.maxBlockSize);
+                const bool hasSamples = header.audioMode == CALL_AUDIO_SAMPLES && r.count == 1;
+                if (hasSamples) {
+                    std::copy(samples.begin() + r.payload.audio.samplePosition,
+                              samples.begin() + r.payload.audio.samplePosition + r.frames, buffer.begin());
+                } else if (header.audioMode == CALL_AUDIO_HASH && r.payload.audio.hash == silenceHash(r.frames)) {
+                    std::fill(buffer.begin(), buffer.end(), 0.0f);
+                    ++result.silentBlocks;
+                } else {
+                    // Also for updates whose samples were dropped while recording.
+                    fillNoise(buffer, r.sourceId, r.block);
+                }
+                if (hasSamples) {
+                    ++result.verifiedBlocks;
+                    if (fnv1aHash(buffer.data(), r.frames * sizeof(float)) != r.payload.audio.hash) {
+                        if (result.mismatchedBlocks++ == 0) {
+                            fprintf(stderr, "input of source %d at block %llu differs from the recording\n",
+                                    r.sourceId, (unsigned long long) r.block);
+                        }
+                    }
+                }
+                // The engine keeps the pointer, so each source's buffer stays in place.
+                leia_source_audio_update(leia, r.sourceId, buffer.data(), r.frames);
+                break;
+            }
+            case LEIA_CALL_PROCESS_SOURCE_AUDIO: {
+                auto begin = std::chrono::steady_clock::now();
+                leia_process_source_audio(leia, out, r.frames);
+                auto end = std::chrono::steady_clock::now();
+                result.blockTimes.push_back(std::chrono::duration<double, std::micro>(end - begin).count());
+                break;
+            }
+            default:
+                fprintf(stderr, "skipping unknown call %u\n", r.call);
+                break;
+        }
+    }
+    leia_delete(leia);
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <call log> [repetitions]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const int repetitions = argc > 2 ? std::max(1, atoi(argv[2])) : 1;
+
+    CallLogHeader header;
+    std::vector<CallRecord> records;
+    std::vector<float> samples;
+    if (!readLog(argv[1], header, records, samples)) {
+        fprintf(stderr, "%s is not a Leia call log of version %u\n", argv[1], CALL_LOG_VERSION);
+        return EXIT_FAILURE;
+    }
+    printf("%zu calls at %u Hz, max block size %u, audio mode %u\n",
+           records.size(), header.sampleRate, header.maxBlockSize, header.audioMode);
+    if (header.droppedRecords > 0) {
+        printf("WARNING: %llu records were dropped while recording; the replay is not exact.\n",
+               (unsigned long long) header.droppedRecords);
+    }
+
+    bool verified = true;
+    for (int i = 0; i < repetitions; ++i) {
+        ReplayResult result = replay(header, records, samples);
+        if (i == 0 && header.audioMode == CALL_AUDIO_SAMPLES) {
+            printf("input: %zu of %zu source blocks differ from the recorded hashes\n",
+                   result.mismatchedBlocks, result.verifiedBlocks);
+            verified = result.mismatchedBlocks == 0;
+        } else if (i == 0 && header.audioMode == CALL_AUDIO_HASH) {
+            printf("input: %zu source blocks replayed as silence by their hash, the others as unverified noise\n",
+                   result.silentBlocks);
+        }
+        if (i == 0 && result.invalidRecords > 0) {
+            printf("WARNING: %zu audio updates did not fit the log and were skipped.\n", result.invalidRecords);
+        }
+        std::vector<double>& times = result.blockTimes;
+        if (times.empty()) { continue; }
+        std::sort(times.begin(), times.end());
+        const double blockBudget = 1e6 * header.maxBlockSize / header.sampleRate;
+        printf("run %d: %zu blocks, median %.1f us, p99 %.1f us, max %.1f us (budget %.1f us at max block size)\n",
+               i, times.size(), times[times.size() / 2], times[times.size() * 99 / 100], times.back(), blockBudget);
+    }
+    return verified ? EXIT_SUCCESS : EXIT_FAILURE;
+}